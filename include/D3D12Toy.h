@@ -2,12 +2,32 @@
 #include "DXSample.h"
 #include "Tools/GeometryGenerator.h"
 #include "Tools/Camera.h"
+#include "Tools/MeshCache.h"
+#include "Tools/MeshOptimizer.h"
+#include "Tools/VertexFormat.h"
+#include "Tools/IndexPacker.h"
+#include "Tools/MeshletBuilder.h"
+#include "Tools/MeshSimplifier.h"
+#include "Tools/FrustumCuller.h"
+#include "Tools/DynamicBVH.h"
+#include "Tools/OcclusionBuffer.h"
+#include "Tools/DrawSortKey.h"
+#include "Tools/SlotMap.h"
+#include "Tools/TransformStore.h"
+#include "Tools/MpscRing.h"
+#include "Tools/JobSystem.h"
+#include "Tools/CommandListPool.h"
+#include "Tools/FramePacer.h"
+#include "Tools/TripleBuffer.h"
 
 #include "CompiledShaders/DefaultVertexShader.inc"
 #include "CompiledShaders/DefaultPixelShader.inc"
 #include "CompiledShaders/GridPixelShader.inc"
-#include <queue>
+#include <algorithm>
+#include <tuple>
+#include <condition_variable>
 #include <mutex>
+#include <thread>
 
 constexpr auto MAX_DIRECT_LIGHT_SOURCE_NUM = 8;
 constexpr auto MAX_POINT_LIGHT_SOURCE_NUM = 8;
@@ -16,6 +36,12 @@ constexpr auto MAX_SPOT_LIGHT_SOURCE_NUM = 4;
 using namespace DirectX;
 using Microsoft::WRL::ComPtr;
 
+//Vertex layout of all scene geometry. VertexFormat::FullLayout keeps plain floats.
+using SceneVertexLayout = VertexFormat::CompactLayout;
+using SceneVertex = SceneVertexLayout::Vertex;
+//Every index range is rebased to fit 16 bits, see IndexPacker
+using SceneIndex = uint16_t;
+
 class D3DToy : public DXSample
 {
 public:
@@ -44,17 +70,43 @@ protected:
 
 	bool mWindowd = true;
 
-	static const int numFrameResources = 3;
+	bool mClusterCulling = true; //Toggle with 'C'
+	bool mLodSelection = true; //Toggle with 'L'
+	bool mFrustumCulling = true; //Toggle with 'F'
+	bool mOcclusionCulling = true; //Toggle with 'O'
+	//Largest screen space error a LOD level may show, in pixels
+	static constexpr float kLodPixelError = 1.0f;
+
+	//Frame resources exist for FramePacer::kMaxFramesInFlight frames, mFramePacer cycles through the first few
 
+	//Owned by the simulation thread once it runs, rendering only reads what is fixed at construction
+	//(viewport, scissor, FOV, clip planes)
 	std::unique_ptr<Camera> mCam;
+	//Worker pool shared by loading, per-frame updates and culling
+	JobSystem mJobs;
+	static constexpr size_t kInstanceGrain = 256;
+	static constexpr size_t kMeshletCullGrain = 4;
+	//Fewer batches than this per command list cost more in list setup than they save
+	static constexpr size_t kDrawBatchGrain = 64;
 
 private:
 	// Constant data per-object.
+	//Per instance data, one element per drawn item in FrameResource::instanceBuffer
 	struct ObjectConstants
 	{
 		XMFLOAT4X4 world;
+		//Vertex decode for SceneVertexLayout, posL = pos * positionScale + positionBias
+		XMFLOAT3 positionScale = XMFLOAT3(1.0f, 1.0f, 1.0f);
+		UINT octNormal = 0;
+		XMFLOAT3 positionBias = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		float pad = 0.0f;
 	};
-	const UINT objCBByteSize = CalcConstBufferByteSizes(sizeof(ObjectConstants));
+	static void SetVertexDecode(ObjectConstants& objConst, const MeshGeometry* geometry)
+	{
+		objConst.positionScale = geometry->positionScale;
+		objConst.positionBias = geometry->positionBias;
+		objConst.octNormal = SceneVertexLayout::kOctNormal ? 1 : 0;
+	}
 	// Constant data per pass
 	struct PassConstants
 	{
@@ -99,10 +151,9 @@ private:
 	//Constant buffer info used for different levels of CBV update frequency.
 	struct FrameResource {
 	public:
-		FrameResource(ID3D12Device* device, UINT passCount, UINT objectCount, UINT materialCount)
+		FrameResource(ID3D12Device* device, UINT passCount, UINT instanceCount, UINT materialCount)
 		{
-			ThrowIfFailed(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&cmdAllocator)));
-			objCB = std::make_unique<UploadBuffer<ObjectConstants>>(device, objectCount, true);
+			instanceBuffer = std::make_unique<UploadBuffer<ObjectConstants>>(device, instanceCount, false);
 			materialCB = std::make_unique<UploadBuffer<MaterialConstants>>(device, materialCount, true);
 			passCB = std::make_unique<UploadBuffer<PassConstants>>(device, passCount, true);
 			lightCB = std::make_unique<UploadBuffer<LightConstants>>(device, passCount, true);
@@ -111,12 +162,10 @@ private:
 		FrameResource& operator=(const FrameResource& rhs) = delete;
 		~FrameResource() {}
 
-		// We cannot reset the allocator until the GPU is done processing commands. 
-		// Each frame needs their own allocator.
-		ComPtr<ID3D12CommandAllocator> cmdAllocator;
+		//Command allocators of the frame live in mCommandListPool
 		// We cannot update a cbuffer until the GPU is done processing commands that reference it.Each frame needs their own cbuffers.
-		//Obj constant buffer (Per obj)
-		std::unique_ptr<UploadBuffer<ObjectConstants>> objCB = nullptr;
+		//Structured buffer of the instances drawn this frame, read by SV_InstanceID
+		std::unique_ptr<UploadBuffer<ObjectConstants>> instanceBuffer = nullptr;
 		//Material constant buffer(Per obj)
 		std::unique_ptr<UploadBuffer<MaterialConstants>> materialCB = nullptr;
 
@@ -126,43 +175,64 @@ private:
 		std::unique_ptr<UploadBuffer<LightConstants>> lightCB = nullptr;
 		//Dynamic vertex buffer
 		//std::unique_ptr<UploadBuffer<Vertex>> waveVB = nullptr;
-		
-		// Fence value to mark commands up to this fence point. This lets us
-		// check if these frame resources are still in use by the GPU.
-		UINT64 fence = 0;
+		//mFramePacer tracks when the GPU is done with them
+	};
+	//Resolved once at load, the per-frame code never looks anything up by name
+	struct MaterialItem;
+	using MaterialHandle = SlotHandle<MaterialItem>;
+	using TextureHandle = SlotHandle<Texture>;
+	using PSOHandle = SlotHandle<ComPtr<ID3D12PipelineState>>;
+	//Which of the per-PSO lists an item belongs to
+	enum class RenderLayer
+	{
+		Opaque,
+		Transparent,
+		WireFrame
 	};
 	//Aggregation of rendering information used for different PSO(Opaque, transparent...)
 	struct RenderItem
 	{
-		RenderItem()
-		{
-			XMStoreFloat4x4(&world, XMMatrixIdentity());
-			XMStoreFloat4x4(&scaling, XMMatrixIdentity());
-		}
 		std::string id; //not unique
-		// World matrix of the shape that describes the objects local space
-		// relative to the world space, which defines the position, 
-		// orientation, and scale of the object in the world.
-		XMFLOAT4X4 world;
-		XMFLOAT4X4 scaling;
-		// Dirty flag indicating the object data has changed and we need 
-		// to update the constant buffer. Because we have an object 
-		// cbuffer for each FrameResource, we have to apply the
-		// update to each FrameResource. Thus, when we modify obj constant data we
-		// should set NumFramesDirty = gNumFrameResources so that each frame resource
-		// gets the update.
-		int numFramesDirty = numFrameResources;
-		// Index into GPU constant buffer corresponding to the ObjectCB for this render item.
-		UINT objCBIndex = -1;
+		// Index of the object transform in mTransforms, items sharing it move together.
+		UINT transform = 0;
 		std::string materialName = "default";
+		MaterialHandle material;
 		// Geometry associated with this render-item. Multiple render-items can share the same geometry.
 		MeshGeometry* geo = nullptr;
+		// Small id of geo for the draw sort key
+		UINT geoSortId = 0;
 		// Primitive topology.
 		D3D12_PRIMITIVE_TOPOLOGY primitiveType = D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST;
 		// DrawIndexedInstanced parameters.
 		UINT indexCount = 0;
 		UINT startIndexLocation = 0;
 		int baseVertexLocation = 0;
+		// Meshlets of the submesh in geo->meshlets, ranges left after cluster culling this frame.
+		UINT firstMeshlet = 0;
+		UINT meshletCount = 0;
+		std::vector<MeshletBuilder::IndexRange> visibleRanges;
+		// visibleRanges are only current when this is the frame's mCullFrame, otherwise the whole range is drawn.
+		UINT64 meshletCullFrame = 0;
+		// LOD level of the submesh, only drawn while it is the level picked by SelectLods().
+		UINT lodLevel = 0;
+		UINT lodCount = 1;
+		UINT selectedLod = 0;
+		// Bounds of the submesh in object space, and in world space as of the last world update.
+		BoundingBox localAabb;
+		BoundingSphere localSphere;
+		BoundingBox worldAabb;
+		BoundingSphere worldSphere;
+		RenderLayer layer = RenderLayer::Opaque;
+		// Proxy of worldAabb in mSceneBVH
+		int bvhProxy = DynamicBVH::kNull;
+	};
+	//Items with the same geometry, index range and material drawn by one DrawIndexedInstanced.
+	//Their instances are consecutive in the frame's instance buffer from instanceBase on.
+	struct InstanceBatch
+	{
+		RenderItem* first = nullptr;
+		UINT instanceBase = 0;
+		UINT instanceCount = 0;
 	};
 	// State records for materials in constant buffer
 	struct MaterialItem
@@ -175,31 +245,58 @@ private:
 		int matCBIndex = -1;
 		//Texture map path
 		std::string texPath;
+		//Invalid when texPath is empty
+		TextureHandle texture;
 		//Dirty flag
-		int numFramesDirty = numFrameResources;
+		int numFramesDirty = FramePacer::kMaxFramesInFlight;
 
 		//Material Data
 		MaterialConstants matConsts;
 	};
 	struct ObjEvent
 	{
-		RenderItem* renderItem;
+		UINT transform;
 		XMMATRIX trans;
 		XMMATRIX rotation;
 		XMMATRIX scaling;
 	};
-	std::queue<ObjEvent> mObjEventQueue;
-	std::mutex mEventQueueMutex; 
+	//Fed from any thread through PostObjEvent(), drained by ProcessObjEvent() on the simulation thread
+	static constexpr size_t kObjEventCapacity = 4096;
+	MpscRing<ObjEvent> mObjEventQueue{ kObjEventCapacity };
+	//Window input for mCam, applied by the simulation thread
+	struct CameraInput
+	{
+		enum class Type { Move, Zoom, Resize };
+		Type type = Type::Move;
+		//Cursor position for Move, the new client size for Resize
+		int x = 0;
+		int y = 0;
+		bool updatePos = false;
+		short delta = 0;
+	};
+	static constexpr size_t kCameraInputCapacity = 4096;
+	MpscRing<CameraInput> mCameraInputQueue{ kCameraInputCapacity };
+	//Events of this frame merged per transform
+	static constexpr UINT kNoPendingEvent = 0xFFFFFFFF;
+	std::vector<ObjEvent> mPendingEvents;
+	std::vector<UINT> mPendingEventIndex;
 
 	ComPtr<IDXGIFactory4> mFactory; //Using DXGIFactory4 for WARP
 	ComPtr<IDXGIAdapter> mAdapter; //GPU adapter
 	ComPtr<ID3D12Device> mDevice; //GPU
 	ComPtr<ID3D12Fence> mFence;	//Fence for synchronization
 	UINT64 mCurrentFenceValue = 0;
+	std::unique_ptr<D3D12FenceWaiter> mFenceWaiter;
+	//Frames in flight, keys 1 to 4 change the depth
+	std::unique_ptr<FramePacer> mFramePacer;
 	ComPtr<IDXGISwapChain3> mSwapChain;
 
 	ComPtr<ID3D12CommandAllocator> mCommandAllocator;
-	ComPtr<ID3D12GraphicsCommandList> mCommandList;
+	ComPtr<ID3D12GraphicsCommandList> mCommandList; //Initialization uploads
+	//Per frame and per job system thread lists used by OnRender()
+	std::unique_ptr<CommandListPool> mCommandListPool;
+	//Lists of this frame in submission order
+	std::vector<ID3D12CommandList*> mSubmitLists;
 	ComPtr<ID3D12CommandQueue> mCommandQueue;
 
 	ComPtr<ID3D12DescriptorHeap> mRTVDescHeap; //Render Target V
@@ -212,15 +309,49 @@ private:
 	ComPtr<ID3D12Resource> mSwapChainBuffer[mBufferCount];
 	ComPtr<ID3D12Resource> mDepthStencilBuffer;
 	
-	std::unordered_map<std::string, std::unique_ptr<Texture>> mTextures;
-	std::unique_ptr<MeshGeometry> mGeometries;
-	std::unordered_map<std::string, std::unique_ptr<MaterialItem>> mMaterialItems;
+	SlotMap<Texture> mTextures;
+	std::unordered_map<std::string, std::unique_ptr<MeshGeometry>> mGeometries;
+	SlotMap<MaterialItem> mMaterialItems;
+	//Name registries for loading and tools
+	std::unordered_map<std::string, TextureHandle> mTextureHandles;
+	std::unordered_map<std::string, MaterialHandle> mMaterialHandles;
 
 	RenderItem* mSpecialRenderItem = nullptr;
 	std::vector<std::unique_ptr<RenderItem>> mRenderItems = {}; //All render items
 	std::vector<RenderItem*> mOpaqueRenderItems; //Divided by different PSO
 	std::vector<RenderItem*> mTransparentRenderItems;
 	std::vector<RenderItem*> mWireFrameRenderItems;
+	//World transforms of the objects, owned by the simulation thread once it runs, and the items using each of them
+	TransformStore mTransforms;
+	std::vector<std::vector<RenderItem*>> mTransformItems;
+	std::vector<UINT> mUpdatedTransforms;
+	//Transforms moved by SimulateStep()
+	std::vector<UINT> mAnimatedTransforms;
+	//Root of the imported model, scaled with the arrow keys
+	UINT mModelTransform = 0;
+	//Opaque items of the selected LOD that passed frustum culling this frame
+	std::vector<RenderItem*> mVisibleOpaqueRenderItems;
+	FrustumCuller mFrustumCuller;
+	std::vector<UINT> mVisibleIndices;
+	//Spatial index over all render items, moved along in UpdateWorldBounds()
+	DynamicBVH mSceneBVH{ mJobs };
+	std::vector<RenderItem*> mFrustumCandidates;
+	//Items whose geometry occluder triangles are drawn into mOcclusionBuffer with their world matrix
+	std::vector<RenderItem*> mOccluderItems;
+	std::vector<OcclusionBuffer::Occluder> mOccluders;
+	OcclusionBuffer mOcclusionBuffer;
+	//Draws of this frame, built after culling
+	std::vector<InstanceBatch> mOpaqueBatches;
+	std::vector<InstanceBatch> mWireFrameBatches;
+	std::vector<RenderItem*> mBatchedItems;
+	UINT mInstanceCount = 0;
+	//Counts OnUpdate() calls, tags the items CullMeshlets() handled this frame
+	UINT64 mCullFrame = 0;
+	//Batches are drawn in DrawSortKey order
+	std::vector<DrawSortKey::Entry> mSortKeys;
+	std::vector<DrawSortKey::Entry> mSortScratch;
+	std::vector<InstanceBatch> mSortedBatches;
+	std::unordered_map<const MeshGeometry*, UINT> mGeometrySortIds;
 
 	std::vector<std::unique_ptr<FrameResource>> mFrameResources;//Constant buffer
 	FrameResource* mCurrentFrameRes = nullptr;
@@ -231,11 +362,47 @@ private:
 	PassConstants mMainPassConst;//View, proj matrix, near Z, far z
 	LightConstants mLights;
 
+	//Everything rendering needs from one simulation step. Immutable once published.
+	struct SimSnapshot
+	{
+		UINT64 step = 0;
+		//Of every transform, row vector convention like TransformStore::World()
+		std::vector<XMFLOAT4X4> worlds;
+		//Step that last moved each transform, bounds are refit for what moved since the last consumed snapshot
+		std::vector<UINT64> changedSteps;
+		XMFLOAT4X4 view;
+		XMFLOAT4X4 proj;
+		//World units to pixels at distance 1, for the viewport height of this step
+		float pixelScale = 0.0f;
+		PassConstants pass;
+		LightConstants lights;
+	};
+	//Simulation runs one step ahead of rendering: OnUpdate() takes the latest snapshot and asks for the next one,
+	//which is computed while the frame is recorded
+	std::thread mSimThread;
+	std::mutex mSimMutex;
+	std::condition_variable mSimWake;
+	bool mSimStop = false;
+	UINT64 mSimRequestedStep = 0;
+	TripleBuffer<SimSnapshot> mSnapshots;
+	//Simulation thread state
+	GameTimer mSimTimer;
+	UINT64 mSimStep = 0;
+	UINT mSimWidth = 0;
+	UINT mSimHeight = 0;
+	std::vector<UINT64> mTransformChangedSteps;
+	//Render thread state, the snapshot of this frame
+	const SimSnapshot* mSnapshot = nullptr;
+	UINT64 mRenderedStep = 0;
+
 	ComPtr<ID3D12DescriptorHeap> mConstBufferDescHeap; //CBV for CPU and GPU commmu
 	ComPtr<ID3D12RootSignature> mRootSignature;
 
-	std::unordered_map<std::string, ComPtr<ID3D12PipelineState>> mPSOMap;
-	ComPtr<ID3D12PipelineState> mCurrentInitialPSO;
+	SlotMap<ComPtr<ID3D12PipelineState>> mPSOs;
+	std::unordered_map<std::string, PSOHandle> mPSOHandles;
+	PSOHandle mTrianglePSO;
+	PSOHandle mLinePSO;
+	PSOHandle mCurrentInitialPSO;
 
 	UINT mRTVDescSize; //Render Target View Descriptor Size
 	UINT mDSVDescSize; //Depth / Stencil
@@ -250,12 +417,27 @@ private:
 	void CreateSamplerDescHeap();
 
 	//Organize geometry, upload to default heap
-	void BuildSingleGeometry(std::vector<std::unique_ptr<RenderItem>>& riList, GeometryGenerator::MeshData& meshData, MeshGeometry* geometry, std::vector<Vertex>& vertices, UINT& vertexOffset, std::vector<uint32_t>& indices, UINT& indexOffset,
-		int objCBIndex, D3D12_PRIMITIVE_TOPOLOGY topology);
+	void BuildSingleGeometry(GeometryGenerator::MeshData& meshData, MeshGeometry* geometry, std::vector<GeometryGenerator::Vertex>& vertices, UINT& vertexOffset, std::vector<SceneIndex>& indices, UINT& indexOffset);
+	//Quantize to SceneVertexLayout, the dequantization is kept in the geometry
+	void PackVertices(MeshGeometry* geometry, const std::vector<GeometryGenerator::Vertex>& vertices, std::vector<SceneVertex>& packed);
+	//Submeshes of one mesh name share a child transform of entityTransform, moving the entity moves them all
+	void BuildRenderItems(std::vector<std::unique_ptr<RenderItem>>& riList, MeshGeometry* geometry, size_t firstSubmesh, size_t submeshCount,
+		UINT entityTransform, D3D12_PRIMITIVE_TOPOLOGY topology);
+	void UploadGeometry(MeshGeometry* geometry, const void* vertexData, UINT vertexCount, const void* indexData, UINT indexCount);
+	//Keeps the coarsest LOD of the submeshes in range as occluder triangles of the geometry
+	void ExtractOccluder(MeshGeometry* geometry, const SceneVertex* vertices, const SceneIndex* indices, size_t firstSubmesh, size_t submeshCount);
+	//Moves the local bounds of the item to world space, call whenever its transform changes
+	void UpdateWorldBounds(RenderItem* ri, FXMMATRIX world);
+	//World matrix of the transform in this frame's snapshot
+	XMMATRIX RenderWorld(UINT transform) const { return XMLoadFloat4x4(&mSnapshot->worlds[transform]); }
+	//Cooked geometry from the mesh cache, parsed and cooked again when the source changed
+	MeshGeometry* LoadObjGeometry(const std::string& path, const std::string& fileName, std::vector<MaterialLoader::Material>& mtlList);
 
 	void BuildGeoAndMat(); //VBV and IBV creating on render
 
 	void SetLights();
+	//Registered material of that name, the default material when there is none
+	MaterialHandle FindMaterial(const std::string& name) const;
 
 	void CreateCBVAndSRVDescHeap();//CB depends on Per-obj constants(mat, geometry)
 
@@ -263,10 +445,38 @@ private:
 
 	void CreatePipelineStateObject(); 
 
-	void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems);
-
+	//Groups the items of their selected LOD into batches, writes their instances to the frame's instance buffer
+	//and sorts the batches by state, then front to back
+	void BuildInstanceBatches(const std::vector<RenderItem*>& ritems, RenderLayer layer, FXMMATRIX view, std::vector<InstanceBatch>& batches);
+	//Only sets the state that differs from the previous batch
+	void DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<InstanceBatch>& batches, size_t begin, size_t end);
+	//A list from the pool for the calling thread with the render target and root bindings shared by every draw
+	ID3D12GraphicsCommandList* BeginDrawList(D3D12_CPU_DESCRIPTOR_HANDLE rtvHandle, D3D12_CPU_DESCRIPTOR_HANDLE dsvHandle);
+	//Fills RenderItem::visibleRanges from the meshlets of every item
+	void CullMeshlets(const std::vector<RenderItem*>& ritems, FXMMATRIX view, CXMMATRIX proj);
+	//Drawn from visibleRanges instead of the whole index range
+	bool IsClusterCulled(const RenderItem* ri) const { return ri->meshletCullFrame == mCullFrame; }
+	//Items of the layer whose fat box in mSceneBVH touches the view frustum, every LOD level
+	void QueryFrustumCandidates(FXMMATRIX view, CXMMATRIX proj, RenderLayer layer, std::vector<RenderItem*>& candidates);
+	//Writes the items of the selected LOD whose world AABB intersects the frustum to visible
+	void CullRenderItems(const std::vector<RenderItem*>& ritems, FXMMATRIX viewProj, std::vector<RenderItem*>& visible);
+	//Rasterizes the occluders and drops the items hidden behind them
+	void CullOccluded(FXMMATRIX viewProj, std::vector<RenderItem*>& visible);
+	//Picks RenderItem::selectedLod from the projected simplification error
+	void SelectLods(const std::vector<RenderItem*>& ritems, FXMMATRIX view, float pixelScale);
+
+	//Thread safe
+	void PostObjEvent(const ObjEvent& event);
 	void ProcessObjEvent();
 
+	//Animation, camera input, object events and pass and light constants of one step, published to mSnapshots
+	void SimulateStep();
+	void SimulationLoop();
+	void StopSimulation();
+	//Takes the latest snapshot, refits the bounds of what moved and asks for the next step
+	void ConsumeSnapshot();
+	void PostCameraInput(const CameraInput& input);
+
 	void FlushCommandQueue();
 
 };
\ No newline at end of file
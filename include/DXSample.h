@@ -12,6 +12,7 @@
 #pragma once
 
 #include "Tools/GameTimer.h"
+#include "Tools/FrameLimiter.h"
 #include "DXSampleHelper.h"
 #include "Win32Application.h"
 
@@ -38,6 +39,10 @@ public:
     UINT GetWidth() const           { return mWidth; }
     UINT GetHeight() const          { return mHeight; }
     const WCHAR* GetTitle() const   { return m_title.c_str(); }
+    // Run loop pacing, see FrameLimiter.
+    void WaitForNextFrame()         { mFrameLimiter.WaitForNextFrame(); }
+    bool IsBenchmark() const        { return m_benchmark; }
+    float GetBenchmarkSeconds() const { return m_benchmarkSeconds; }
 
     void ParseCommandLineArgs(_In_reads_(argc) WCHAR* argv[], int argc);
 
@@ -53,8 +58,20 @@ protected:
 
     // Adapter info.
     bool m_useWarpDevice;
+    // Run the CPU culling benchmark at startup ("-cullbench").
+    bool m_cullBenchmark;
+    // Check the frame pacer against a fake fence at startup ("-pacertest").
+    bool m_pacerSelfTest;
+    // Frames the CPU may run ahead of the GPU ("-frames N"), 1 to 4.
+    UINT m_framesInFlight;
+    // Frame rate cap ("-fps N"), 0 runs uncapped.
+    float m_targetFps;
+    // Uncapped run that reports its frame rate on exit ("-benchmark [seconds]"), 0 seconds runs until closed.
+    bool m_benchmark;
+    float m_benchmarkSeconds;
     //Timer
     GameTimer mTimer;
+    FrameLimiter mFrameLimiter;
 private:
     // Root assets path.
     std::wstring m_assetsPath;
@@ -0,0 +1,55 @@
+#pragma once
+#include "stdafx.h"
+#include "DXSampleHelper.h"
+#include <vector>
+
+//Command allocators and lists for every frame in flight and every recording thread. Each thread records
+//into its own allocator, so no locking is needed, and may take several lists from it as long as it closes
+//one before taking the next. Allocators are created up front and reset when their frame comes around again,
+//lists are only created while the pool warms up.
+class CommandListPool
+{
+public:
+	//Usage tracking. D3D12 does not report allocator sizes, an allocator keeps the memory of the most
+	//commands it ever held, so the peak number of lists recorded into one between resets stands in for it.
+	struct Stats
+	{
+		UINT allocatorCount = 0;
+		UINT listCount = 0;
+		UINT peakListsPerAllocator = 0;
+		UINT peakListsPerFrame = 0;
+	};
+
+	CommandListPool(ID3D12Device* device, UINT frameCount, UINT threadCount,
+		D3D12_COMMAND_LIST_TYPE type = D3D12_COMMAND_LIST_TYPE_DIRECT);
+	CommandListPool(const CommandListPool&) = delete;
+	CommandListPool& operator=(const CommandListPool&) = delete;
+
+	//Recycles the allocators and lists of the frame. The GPU has to be done with them, FramePacer::BeginFrame()
+	//waits for that. Main thread.
+	void BeginFrame(UINT frameIndex);
+	//A reset list recording into the allocator of thread in the current frame. Only thread may call it.
+	ID3D12GraphicsCommandList* Acquire(UINT thread, ID3D12PipelineState* initialState);
+
+	Stats GetStats() const;
+
+private:
+	struct ThreadSlot
+	{
+		ComPtr<ID3D12CommandAllocator> allocator;
+		std::vector<ComPtr<ID3D12GraphicsCommandList>> lists;
+		//Lists handed out since the last reset
+		UINT used = 0;
+		UINT peakUsed = 0;
+	};
+	struct Frame
+	{
+		std::vector<ThreadSlot> threads;
+	};
+
+	ID3D12Device* mDevice;
+	D3D12_COMMAND_LIST_TYPE mType;
+	std::vector<Frame> mFrames;
+	UINT mCurrentFrame = 0;
+	UINT mPeakListsPerFrame = 0;
+};
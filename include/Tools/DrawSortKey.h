@@ -0,0 +1,33 @@
+#pragma once
+#include "stdafx.h"
+
+//64-bit draw sort key. Fields from the most to the least significant bit, so that sorting the keys
+//groups draws by the state that is most expensive to change:
+//  pso 4 | root signature 2 | material CB 12 | texture SRV 12 | geometry 8 | depth 26
+//The index of the draw a key was built for travels next to it in an Entry, so any number of draws sorts.
+class DrawSortKey
+{
+public:
+	static constexpr UINT kPsoBits = 4;
+	static constexpr UINT kRootSignatureBits = 2;
+	static constexpr UINT kMaterialBits = 12;
+	static constexpr UINT kTextureBits = 12;
+	static constexpr UINT kGeometryBits = 8;
+	static constexpr UINT kDepthBits = 26;
+	//Texture field of untextured draws, they sort after the textured ones
+	static constexpr UINT kNoTexture = (1u << kTextureBits) - 1;
+	static_assert(kPsoBits + kRootSignatureBits + kMaterialBits + kTextureBits + kGeometryBits + kDepthBits == 64,
+		"Sort key fields must fill 64 bits");
+
+	struct Entry
+	{
+		UINT64 key;
+		UINT index;
+	};
+
+	//Fields are masked to their width, depth is clamped to [0, 1] and quantized front to back
+	static UINT64 Pack(UINT pso, UINT rootSignature, UINT material, UINT texture, UINT geometry, float depth);
+
+	//Stable LSD radix sort by key, 8 bits per pass. Passes where all keys share the digit are skipped.
+	static void RadixSort(std::vector<Entry>& entries, std::vector<Entry>& scratch);
+};
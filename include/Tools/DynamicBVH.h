@@ -0,0 +1,199 @@
+#pragma once
+#include "stdafx.h"
+#include <DirectXCollision.h>
+#include "Tools/JobSystem.h"
+
+//Dynamic AABB tree over world space boxes. Leaves store fattened boxes, so small moves only refit the
+//leaf and its ancestors instead of reinserting. Insertions pick the sibling with the lowest surface area
+//cost and rotate to keep the tree balanced. When the total surface area drifts too far from the last
+//full build, a binned SAH rebuild runs as a job and is swapped in by Update().
+class DynamicBVH
+{
+public:
+	static constexpr int kNull = -1;
+
+	explicit DynamicBVH(JobSystem& jobs) : mJobs(jobs) {}
+	~DynamicBVH();
+	DynamicBVH(const DynamicBVH&) = delete;
+	DynamicBVH& operator=(const DynamicBVH&) = delete;
+
+	//Returns a proxy id that stays valid until DestroyProxy, also across rebuilds
+	int CreateProxy(const DirectX::BoundingBox& aabb, void* userData);
+	void DestroyProxy(int proxy);
+	//Returns true when the box left its fat box and the leaf had to grow
+	bool MoveProxy(int proxy, const DirectX::BoundingBox& aabb);
+	void* GetUserData(int proxy) const { return mProxies[proxy].userData; }
+
+	//Swaps in a finished rebuild and starts a new one when the tree quality degraded. Call once per frame.
+	void Update();
+	//Blocks until a running rebuild is swapped in
+	void FinishRebuild();
+	//Sum of the surface areas of the internal nodes, the SAH cost up to constant factors
+	float ComputeCost() const;
+	int GetHeight() const { return mRoot == kNull ? 0 : mNodes[mRoot].height; }
+	UINT ProxyCount() const { return mProxyCount; }
+
+	//callback(void* userData) for every leaf whose fat box intersects the frustum
+	template<typename Callback>
+	void QueryFrustum(const DirectX::BoundingFrustum& frustum, Callback&& callback) const;
+	//callback(void* userData) for every leaf whose fat box intersects the sphere
+	template<typename Callback>
+	void QuerySphere(const DirectX::BoundingSphere& sphere, Callback&& callback) const;
+	//float callback(void* userData, float maxDistance) for every leaf whose fat box the ray enters before maxDistance.
+	//Return the distance of an exact hit to clip the ray, or maxDistance to keep going. direction must be normalized.
+	template<typename Callback>
+	void RayCast(DirectX::FXMVECTOR origin, DirectX::FXMVECTOR direction, float maxDistance, Callback&& callback) const;
+
+private:
+	struct Node
+	{
+		DirectX::XMFLOAT3 minimum;
+		DirectX::XMFLOAT3 maximum;
+		int parent = kNull;
+		int child1 = kNull;
+		int child2 = kNull;
+		//Leaf: 0 and the proxy it holds. Free: -1 and parent is the next free node.
+		int height = 0;
+		int proxy = kNull;
+
+		bool IsLeaf() const { return child1 == kNull; }
+		DirectX::BoundingBox Box() const;
+	};
+	struct Proxy
+	{
+		DirectX::BoundingBox aabb;
+		void* userData = nullptr;
+		int node = kNull;
+		bool alive = false;
+		//Touched while a rebuild was running, reconciled when it is swapped in
+		bool changed = false;
+	};
+	struct BuildResult
+	{
+		std::vector<Node> nodes;
+		int root = kNull;
+	};
+	struct BuildInput
+	{
+		DirectX::XMFLOAT3 minimum;
+		DirectX::XMFLOAT3 maximum;
+		int proxy;
+	};
+
+	int AllocateNode();
+	void FreeNode(int node);
+	void InsertLeaf(int leaf);
+	void RemoveLeaf(int leaf);
+	int Balance(int node);
+	void Refit(int node);
+	void SetFatBox(Node& node, const DirectX::BoundingBox& aabb) const;
+	void MarkChanged(int proxy);
+
+	void StartRebuild();
+	void SwapRebuild(BuildResult& result);
+	static BuildResult BuildSAH(std::vector<BuildInput> inputs);
+
+	std::vector<Node> mNodes;
+	int mRoot = kNull;
+	int mFreeNode = kNull;
+
+	std::vector<Proxy> mProxies;
+	std::vector<int> mFreeProxies;
+	UINT mProxyCount = 0;
+
+	//Quality tracking against the last full build
+	float mBuildCost = 0.0f;
+	UINT mUpdatesSinceCheck = 0;
+
+	JobSystem& mJobs;
+	//mRebuildResult belongs to the job until mRebuildCounter is done
+	JobSystem::Counter mRebuildCounter;
+	BuildResult mRebuildResult;
+	bool mRebuilding = false;
+	std::vector<int> mChangedProxies;
+	//Rebuild when the cost grows this much over the last build
+	static constexpr float kRebuildRatio = 1.5f;
+	static constexpr UINT kQualityCheckInterval = 30;
+	//Leaves are padded by this fraction of their size plus kFatMargin
+	static constexpr float kFatScale = 0.1f;
+	static constexpr float kFatMargin = 0.1f;
+};
+
+template<typename Callback>
+void DynamicBVH::QueryFrustum(const DirectX::BoundingFrustum& frustum, Callback&& callback) const
+{
+	if (mRoot == kNull)
+		return;
+	//Second value is true when the frustum is known to contain the whole subtree
+	std::vector<std::pair<int, bool>> stack;
+	stack.push_back({ mRoot, false });
+	while (!stack.empty())
+	{
+		std::pair<int, bool> entry = stack.back();
+		stack.pop_back();
+		const Node& node = mNodes[entry.first];
+		bool contained = entry.second;
+		if (!contained)
+		{
+			DirectX::ContainmentType containment = frustum.Contains(node.Box());
+			if (containment == DirectX::DISJOINT)
+				continue;
+			contained = containment == DirectX::CONTAINS;
+		}
+		if (node.IsLeaf())
+		{
+			callback(mProxies[node.proxy].userData);
+			continue;
+		}
+		stack.push_back({ node.child1, contained });
+		stack.push_back({ node.child2, contained });
+	}
+}
+template<typename Callback>
+void DynamicBVH::QuerySphere(const DirectX::BoundingSphere& sphere, Callback&& callback) const
+{
+	if (mRoot == kNull)
+		return;
+	std::vector<int> stack;
+	stack.push_back(mRoot);
+	while (!stack.empty())
+	{
+		const Node& node = mNodes[stack.back()];
+		stack.pop_back();
+		if (!sphere.Intersects(node.Box()))
+			continue;
+		if (node.IsLeaf())
+		{
+			callback(mProxies[node.proxy].userData);
+			continue;
+		}
+		stack.push_back(node.child1);
+		stack.push_back(node.child2);
+	}
+}
+template<typename Callback>
+void DynamicBVH::RayCast(DirectX::FXMVECTOR origin, DirectX::FXMVECTOR direction, float maxDistance, Callback&& callback) const
+{
+	if (mRoot == kNull)
+		return;
+	std::vector<int> stack;
+	stack.push_back(mRoot);
+	while (!stack.empty())
+	{
+		const Node& node = mNodes[stack.back()];
+		stack.pop_back();
+		float distance;
+		DirectX::BoundingBox box = node.Box();
+		//Intersects() misses rays starting inside the box
+		if (box.Contains(origin) == DirectX::DISJOINT && (!box.Intersects(origin, direction, distance) || distance > maxDistance))
+			continue;
+		if (node.IsLeaf())
+		{
+			float hit = callback(mProxies[node.proxy].userData, maxDistance);
+			maxDistance = hit < maxDistance ? hit : maxDistance;
+			continue;
+		}
+		stack.push_back(node.child1);
+		stack.push_back(node.child2);
+	}
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "stdafx.h"
+
+//Paces the run loop to a target frame rate. Sleeps on a high resolution waitable timer until shortly before
+//the frame is due and spins the rest, sleeping alone overshoots by up to a scheduler tick.
+//A target of 0 leaves the loop uncapped.
+class FrameLimiter
+{
+public:
+	explicit FrameLimiter(float targetFps = 0.0f);
+	~FrameLimiter();
+	FrameLimiter(const FrameLimiter&) = delete;
+	FrameLimiter& operator=(const FrameLimiter&) = delete;
+
+	void SetTargetFps(float targetFps);
+	float TargetFps() const { return mTargetFps; }
+	//Returns when the next frame is due, right away when uncapped
+	void WaitForNextFrame();
+
+private:
+	__int64 Now() const;
+
+	HANDLE mTimer = nullptr;
+	float mTargetFps = 0.0f;
+	__int64 mCountsPerSecond = 0;
+	__int64 mFramePeriod = 0;
+	//Counter value the next frame is due at, 0 before the first frame
+	__int64 mNextFrame = 0;
+	//Left for spinning, covers the timer's wake up latency
+	__int64 mSpinCounts = 0;
+	static constexpr float kSpinSeconds = 0.001f;
+	//Regular timers wake up on the scheduler tick
+	static constexpr float kCoarseSpinSeconds = 0.016f;
+};
@@ -0,0 +1,78 @@
+#pragma once
+#include "stdafx.h"
+
+//Ring of frames in flight. BeginFrame() moves to the next slot and blocks until the GPU finished the frame
+//that used the slot last, EndFrame() stamps the slot with the fence value signaled after the submit.
+//The depth can change at runtime, frame resources are allocated for kMaxFramesInFlight up front.
+class FramePacer
+{
+public:
+	static constexpr UINT kMaxFramesInFlight = 4;
+
+	//What the pacer waits on. D3D12FenceWaiter wraps an ID3D12Fence, a fake only has to count.
+	class Fence
+	{
+	public:
+		virtual ~Fence() = default;
+		virtual UINT64 CompletedValue() const = 0;
+		//Returns once CompletedValue() reached value
+		virtual void Wait(UINT64 value) = 0;
+	};
+
+	//framesInFlight is clamped to [1, kMaxFramesInFlight]
+	FramePacer(Fence& fence, UINT framesInFlight);
+	FramePacer(const FramePacer&) = delete;
+	FramePacer& operator=(const FramePacer&) = delete;
+
+	//Slot of the new frame, its resources are free to write when this returns
+	UINT BeginFrame();
+	void EndFrame(UINT64 fenceValue);
+	//Blocks until every frame stamped so far finished
+	void WaitIdle();
+	//Drains the ring, the next BeginFrame() starts again at slot 0. Call between frames.
+	void SetFramesInFlight(UINT framesInFlight);
+
+	UINT FramesInFlight() const { return mFramesInFlight; }
+	UINT CurrentSlot() const { return mSlot; }
+	//CPU time BeginFrame() spent blocked on the GPU
+	double LastWaitMs() const { return mLastWaitMs; }
+	double AverageWaitMs() const { return mAverageWaitMs; }
+	double PeakWaitMs() const { return mPeakWaitMs; }
+
+	//Checks ring order, waits on slot reuse and SetFramesInFlight() draining against a fake fence.
+	//Reports with OutputDebugString, returns false when a check failed.
+	static bool SelfTest();
+
+private:
+	void WaitFor(UINT64 value);
+
+	Fence& mFence;
+	UINT mFramesInFlight;
+	UINT mSlot;
+	//Fence value of the last frame submitted from each slot, 0 when the slot is free
+	UINT64 mSlotFences[kMaxFramesInFlight] = {};
+	UINT64 mLastFence = 0;
+
+	double mLastWaitMs = 0.0;
+	double mAverageWaitMs = 0.0;
+	double mPeakWaitMs = 0.0;
+	//Weight of the newest frame in the moving average
+	static constexpr double kWaitSmoothing = 0.05;
+};
+
+//Fence of a D3D12 command queue, waits on one event created up front
+class D3D12FenceWaiter : public FramePacer::Fence
+{
+public:
+	explicit D3D12FenceWaiter(ID3D12Fence* fence);
+	~D3D12FenceWaiter();
+	D3D12FenceWaiter(const D3D12FenceWaiter&) = delete;
+	D3D12FenceWaiter& operator=(const D3D12FenceWaiter&) = delete;
+
+	UINT64 CompletedValue() const override { return mFence->GetCompletedValue(); }
+	void Wait(UINT64 value) override;
+
+private:
+	ID3D12Fence* mFence;
+	HANDLE mEvent;
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include "stdafx.h"
+#include <DirectXCollision.h>
+
+//Tests world space AABBs against the six planes of a view-projection matrix, four boxes per iteration.
+//Boxes are kept in SoA form (one array per component) so every plane test is a handful of vector ops.
+class FrustumCuller
+{
+public:
+	FrustumCuller();
+
+	//Extracts the planes of the D3D clip volume (0 <= z <= w), normals pointing inside
+	void SetViewProj(DirectX::FXMMATRIX viewProj);
+
+	void Clear();
+	//Returns the index reported by Cull()
+	UINT Add(const DirectX::BoundingBox& aabb);
+	UINT Count() const { return mCount; }
+
+	//Appends the indices of the boxes intersecting the frustum in insertion order, conservative at the corners
+	void Cull(std::vector<UINT>& visible) const;
+	//Same test one box at a time, for reference
+	bool IsVisible(const DirectX::BoundingBox& aabb) const;
+
+	//Times Cull() against IsVisible() over boxCount boxes from GeometryGenerator::BuildBox, reports with OutputDebugString
+	static void Benchmark(UINT boxCount);
+
+private:
+	DirectX::XMFLOAT4 mPlanes[6];
+
+	//Padded to a multiple of 4
+	std::vector<float> mCenterX, mCenterY, mCenterZ;
+	std::vector<float> mExtentX, mExtentY, mExtentZ;
+	UINT mCount = 0;
+};
@@ -1,10 +1,13 @@
 #pragma once
 #include "stdafx.h"
 #include "DXSampleHelper.h"
+#include <DirectXCollision.h>
 #include <fstream>
 #include <unordered_set>
 #include "Tools/MaterialLoader.h"
 
+class JobSystem;
+
 class GeometryGenerator
 {
 public:
@@ -48,32 +51,58 @@ public:
 		std::vector<Vertex> vertices;
 		std::vector<IndicesGroup> idxGroups;
 		std::vector<uint32_t> indices;
+		//Coarser index sets over the same vertices, see MeshSimplifier
+		struct LodLevel
+		{
+			std::vector<IndicesGroup> idxGroups;
+			//Object space distance the surface may have moved from level 0. Sum of the collapse errors of every
+			//level up to this one, each level is simplified from the previous one.
+			float error = 0.0f;
+		};
+		std::vector<LodLevel> lods;
 	};
 	MeshData BuildCylinder(float bottomR, float topR, float height, uint32_t slice, uint32_t stack);
 	MeshData BuildBox(float length, float width, float height);
 	MeshData BuildGrid(float width, float depth, uint32_t m, uint32_t n);
-	void ReadObjFile(std::string path, std::string fileName, std::vector<GeometryGenerator::MeshData>& storage, std::vector<MaterialLoader::Material>& mtlList);
+	//Chunks are parsed on jobs when given
+	void ReadObjFile(std::string path, std::string fileName, std::vector<GeometryGenerator::MeshData>& storage, std::vector<MaterialLoader::Material>& mtlList, JobSystem* jobs = nullptr);
 	void ReadObjFileInOne(std::string path, std::string fileName, GeometryGenerator::MeshData& storage);//deprecated
+	//Box and sphere around the vertices referenced by indices. The sphere is centered on the box.
+	static void ComputeBounds(const std::vector<Vertex>& vertices, const uint32_t* indices, size_t indexCount,
+		DirectX::BoundingBox& aabb, DirectX::BoundingSphere& sphere);
 private:
 };
-namespace std
-{
-    template<>
-    struct hash<GeometryGenerator::Vertex> {
-        size_t operator()(const GeometryGenerator::Vertex& v) const {
-            // Hash Func
-            auto result = (hash<float>()(v.position.x) ^ hash<float>()(v.texCoordinate.y)) << 1;
-            result >>= 1;
-            result ^= hash<float>()(v.normal.z) << 1;
-            return result;
-        }
-    };
-}
 struct SubmeshGeometry
 {
+    std::string meshName;
+    std::string materialName;
     UINT indexCount = 0;
     UINT startIndexLocation = 0;
     INT baseVertexLocation = 0;
+    //0 is the full mesh, higher levels come from MeshData::lods. lodCount counts the levels of the mesh.
+    UINT lodLevel = 0;
+    UINT lodCount = 1;
+    //Object space bounds of the vertices the submesh draws
+    DirectX::BoundingBox aabb;
+    DirectX::BoundingSphere sphere;
+    //Range in MeshGeometry::meshlets
+    UINT firstMeshlet = 0;
+    UINT meshletCount = 0;
+};
+//Cluster of consecutive triangles of a submesh, see MeshletBuilder
+struct Meshlet
+{
+    //Index range in the index buffer, drawn with the baseVertexLocation of its submesh
+    UINT startIndexLocation = 0;
+    UINT indexCount = 0;
+    UINT vertexCount = 0;
+    //Bounding sphere in object space
+    DirectX::XMFLOAT3 center;
+    float radius = 0.0f;
+    //Normal cone, every triangle faces away when dot(center - eye, coneAxis) >= coneCutoff * |center - eye| + radius.
+    //coneCutoff of 1 means the cone is too wide to cull anything.
+    DirectX::XMFLOAT3 coneAxis;
+    float coneCutoff = 1.0f;
 };
 struct MeshGeometry
 {
@@ -97,12 +126,30 @@ struct MeshGeometry
     DXGI_FORMAT indexFormat = DXGI_FORMAT_R16_UINT;
     UINT indexBufferByteSize = 0;
 
+    //Position dequantization of the vertex buffer, see VertexFormat
+    DirectX::XMFLOAT3 positionScale = DirectX::XMFLOAT3(1.0f, 1.0f, 1.0f);
+    DirectX::XMFLOAT3 positionBias = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+
+    //Object space bounding sphere of all vertices
+    DirectX::XMFLOAT3 boundsCenter = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+    float boundsRadius = 0.0f;
+    //Simplification error of every LOD level, the largest over all meshes. Level 0 is exact.
+    std::vector<float> lodErrors;
+
     // A MeshGeometry may store multiple geometries in one vertex/index 
     // buffer.
     // Use this container to define the Submesh geometries so we can draw
     // the Submeshes individually.
     std::unordered_map<std::string, SubmeshGeometry> drawArgs;
 
+    // Submeshes in build order, drawArgs keys may repeat when a mesh reuses a material.
+    std::vector<SubmeshGeometry> submeshes;
+    // Meshlets of all submeshes, see SubmeshGeometry::firstMeshlet
+    std::vector<Meshlet> meshlets;
+    // Object space triangles rasterized by the software occlusion buffer, the coarsest LOD
+    std::vector<DirectX::XMFLOAT3> occluderPositions;
+    std::vector<uint32_t> occluderIndices;
+
     D3D12_VERTEX_BUFFER_VIEW VertexBufferView() const
     {
         D3D12_VERTEX_BUFFER_VIEW vbv;
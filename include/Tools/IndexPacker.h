@@ -0,0 +1,24 @@
+#pragma once
+#include "stdafx.h"
+#include "Tools/GeometryGenerator.h"
+
+//Splits index lists into ranges whose vertex span fits 16-bit indices. Every range is drawn
+//with its smallest vertex index as baseVertexLocation, so R16_UINT buffers work for any mesh size.
+class IndexPacker
+{
+public:
+	static constexpr uint32_t kMaxSpan = 65536;
+
+	struct Range
+	{
+		size_t firstIndex = 0;
+		size_t indexCount = 0;
+		uint32_t baseVertex = 0; //Smallest vertex index of the range
+	};
+
+	//Consecutive triangles are kept together until the span would exceed maxSpan. A triangle that
+	//cannot be rebased on its own has its vertices duplicated at the end of vertices.
+	static void Split(std::vector<uint32_t>& indices, std::vector<GeometryGenerator::Vertex>& vertices, std::vector<Range>& ranges, uint32_t maxSpan = kMaxSpan);
+	//Appends the range rebased to its baseVertex
+	static void Pack(const std::vector<uint32_t>& indices, const Range& range, std::vector<uint16_t>& packed);
+};
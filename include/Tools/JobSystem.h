@@ -0,0 +1,91 @@
+#pragma once
+#include "stdafx.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+//Fixed pool of worker threads with one job deque each. Owners push and pop at the back, idle workers
+//steal from the front of the others. Threads outside the pool submit to a shared queue and help with
+//any queue while they wait, so waiting inside a job cannot deadlock the pool.
+class JobSystem
+{
+public:
+	//Unfinished jobs submitted with it. Also used as a dependency a job waits for before it starts.
+	struct Counter
+	{
+		std::atomic<int> value{ 0 };
+		bool Done() const { return value.load(std::memory_order_acquire) == 0; }
+	};
+
+	//0 picks one worker per hardware thread besides the calling one
+	explicit JobSystem(UINT workerCount = 0);
+	~JobSystem();
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	//counter goes up now and down once the job returned. The job does not start before dependency is done,
+	//so the jobs counted by dependency have to be submitted first.
+	void Run(std::function<void()> job, Counter* counter = nullptr, const Counter* dependency = nullptr);
+	//Runs queued jobs on the calling thread until counter is done
+	void Wait(const Counter& counter);
+	//function(begin, end) over [0, count) in ranges of about grainSize, the caller takes the first range.
+	//Returns once every range is done.
+	template<typename Function>
+	void ParallelFor(size_t count, size_t grainSize, Function&& function);
+
+	UINT WorkerCount() const { return static_cast<UINT>(mWorkers.size()); }
+	//Index of the calling worker, WorkerCount() for every thread outside the pool
+	UINT ThreadIndex() const { return CurrentQueue(); }
+
+private:
+	struct Job
+	{
+		std::function<void()> function;
+		Counter* counter = nullptr;
+		const Counter* dependency = nullptr;
+	};
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	void WorkerLoop(UINT index);
+	//Own queue first, then the others. False when nothing could run.
+	bool TryRunJob();
+	UINT CurrentQueue() const;
+
+	//One per worker, the last one is shared by threads outside the pool
+	std::vector<std::unique_ptr<Queue>> mQueues;
+	std::vector<std::thread> mWorkers;
+	std::atomic<int> mQueuedJobs{ 0 };
+	std::atomic<bool> mStop{ false };
+	std::mutex mSleepMutex;
+	std::condition_variable mWake;
+};
+
+template<typename Function>
+void JobSystem::ParallelFor(size_t count, size_t grainSize, Function&& function)
+{
+	if (count == 0)
+		return;
+	//A few ranges per thread balance uneven work, more only add overhead
+	size_t maxRanges = (WorkerCount() + 1) * 4;
+	if (grainSize == 0)
+		grainSize = 1;
+	if ((count + grainSize - 1) / grainSize > maxRanges)
+		grainSize = (count + maxRanges - 1) / maxRanges;
+
+	Counter counter;
+	for (size_t begin = grainSize; begin < count; begin += grainSize)
+	{
+		size_t end = (std::min)(begin + grainSize, count);
+		Run([&function, begin, end]() { function(begin, end); }, &counter);
+	}
+	function(static_cast<size_t>(0), (std::min)(grainSize, count));
+	Wait(counter);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "stdafx.h"
+
+//Read-only view of a whole file mapped into the address space.
+//The bytes stay valid until Close() or destruction, nothing is copied.
+class MappedFile
+{
+public:
+	MappedFile() {}
+	~MappedFile();
+	MappedFile(const MappedFile& rhs) = delete;
+	MappedFile& operator=(const MappedFile& rhs) = delete;
+
+	bool Open(const std::string& fileName);
+	void Close();
+
+	bool IsOpen() const { return mFile != INVALID_HANDLE_VALUE; }
+	const char* Data() const { return mData; }
+	const char* End() const { return mData + mSize; }
+	size_t Size() const { return mSize; }
+private:
+	HANDLE mFile = INVALID_HANDLE_VALUE;
+	HANDLE mMapping = nullptr;
+	const char* mData = nullptr;
+	size_t mSize = 0;
+};
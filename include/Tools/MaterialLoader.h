@@ -26,16 +26,37 @@ public:
 	MaterialLoader()
 	{
 	}
-	static void CreateTextureFromFile(std::string fileName, ComPtr<ID3D12Device>& device, ComPtr<ID3D12GraphicsCommandList>& cmdList, ComPtr<ID3D12Resource>& res, ComPtr<ID3D12Resource>& uploadHeap)
+	//Decoded R8G8B8A8 pixels, release with stbi_image_free
+	struct Image
+	{
+		int width = 0;
+		int height = 0;
+		stbi_uc* pixels = nullptr;
+	};
+	//Decoding only, safe on any thread
+	static Image LoadImageFile(const std::string& fileName)
 	{
-		int texWidth, texHeight;
+		Image image;
 		//Real components num of tex(RGB/RGBA)
 		int numComponents;
-		int singlePixelSize = sizeof(uint32_t); //R8G8B8A8
 		//OpenGL bottom-left, DirectX top-left
 		//So the texture in the buffer should be flipped manually/automatically in DirectX.
-		stbi_set_flip_vertically_on_load(true); 
-		stbi_uc* tex = stbi_load(fileName.c_str(), &texWidth, &texHeight, &numComponents, STBI_rgb_alpha);
+		stbi_set_flip_vertically_on_load_thread(true);
+		image.pixels = stbi_load(fileName.c_str(), &image.width, &image.height, &numComponents, STBI_rgb_alpha);
+		return image;
+	}
+	static void CreateTextureFromFile(std::string fileName, ComPtr<ID3D12Device>& device, ComPtr<ID3D12GraphicsCommandList>& cmdList, ComPtr<ID3D12Resource>& res, ComPtr<ID3D12Resource>& uploadHeap)
+	{
+		Image image = LoadImageFile(fileName);
+		CreateTextureFromImage(image, device, cmdList, res, uploadHeap);
+		stbi_image_free(image.pixels);
+	}
+	//Records the upload on cmdList, the pixels are copied to uploadHeap before it returns
+	static void CreateTextureFromImage(const Image& image, ComPtr<ID3D12Device>& device, ComPtr<ID3D12GraphicsCommandList>& cmdList, ComPtr<ID3D12Resource>& res, ComPtr<ID3D12Resource>& uploadHeap)
+	{
+		int texWidth = image.width, texHeight = image.height;
+		int singlePixelSize = sizeof(uint32_t); //R8G8B8A8
+		const stbi_uc* tex = image.pixels;
 
 		//https://github.com/microsoft/DirectX-Graphics-Samples/blob/master/Samples/Desktop/D3D12HelloWorld/src/HelloTexture/D3D12HelloTexture.cpp
 		//Similar to CreateDefaultBuffer()
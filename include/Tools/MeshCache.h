@@ -0,0 +1,67 @@
+#pragma once
+#include "stdafx.h"
+#include "Tools/GeometryGenerator.h"
+#include "Tools/MappedFile.h"
+#include "Tools/MeshSimplifier.h"
+
+//Versioned binary container for cooked geometry: the final vertex array, index array and the
+//submesh table exactly as they are uploaded. A hit skips OBJ parsing and vertex dedupe entirely.
+//
+//Layout: MeshCacheHeader | submesh table | vertices (16-byte aligned) | indices | meshlets
+class MeshCache
+{
+public:
+	//Bump whenever the cooked output of the import pipeline changes.
+	static constexpr uint32_t kVersion = 9;
+	static constexpr uint32_t kMagic = 0x434D5844; //"DXMC"
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;
+		uint32_t vertexFormat;
+		uint32_t vertexStride;
+		uint32_t vertexCount;
+		uint32_t indexStride;
+		uint32_t indexCount;
+		uint32_t submeshCount;
+		uint32_t submeshTableOffset;
+		uint64_t vertexDataOffset;
+		uint64_t indexDataOffset;
+		uint64_t meshletDataOffset;
+		uint32_t meshletCount;
+		DirectX::XMFLOAT3 positionScale;
+		DirectX::XMFLOAT3 positionBias;
+		DirectX::XMFLOAT3 boundsCenter;
+		float boundsRadius;
+		uint32_t lodCount;
+		float lodErrors[MeshSimplifier::kMaxLodLevels + 1];
+	};
+	//Cooked data, viewed in place after Load. Pointers are valid while the MappedFile stays open.
+	struct View
+	{
+		uint32_t vertexFormat = 0; //VertexFormat::Layout<>::kId
+		DirectX::XMFLOAT3 positionScale = DirectX::XMFLOAT3(1.0f, 1.0f, 1.0f);
+		DirectX::XMFLOAT3 positionBias = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+		DirectX::XMFLOAT3 boundsCenter = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+		float boundsRadius = 0.0f;
+		std::vector<float> lodErrors; //MeshGeometry::lodErrors
+		const void* vertexData = nullptr;
+		UINT vertexCount = 0;
+		UINT vertexStride = 0;
+		const void* indexData = nullptr;
+		UINT indexCount = 0;
+		UINT indexStride = 0;
+		std::vector<SubmeshGeometry> submeshes;
+		std::vector<Meshlet> meshlets;
+	};
+
+	//Hash of the OBJ file and every material library it references. mtlLibs receives the library names.
+	static uint64_t HashSource(const std::string& path, const std::string& objFileName, std::vector<std::string>& mtlLibs);
+
+	static bool Load(const std::string& cacheFile, uint64_t sourceHash, MappedFile& file, View& view);
+	static bool Save(const std::string& cacheFile, uint64_t sourceHash, const View& view);
+
+	static uint64_t HashBytes(const void* data, size_t size, uint64_t seed);
+};
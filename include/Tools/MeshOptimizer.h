@@ -0,0 +1,31 @@
+#pragma once
+#include "stdafx.h"
+#include "Tools/GeometryGenerator.h"
+
+//Offline reordering of imported meshes before they are cooked:
+//triangle order for the post-transform vertex cache (Tipsify, Sander et al. 2007),
+//optional outward-facing-first cluster order against overdraw, vertex order for fetch locality.
+class MeshOptimizer
+{
+public:
+	static constexpr UINT kCacheSize = 16;
+
+	struct CacheStats
+	{
+		float acmr = 0.0f; //Transformed vertices per triangle
+		float atvr = 0.0f; //Transformed vertices per referenced vertex
+	};
+
+	//Every index group of the mesh, then the shared vertex array. Stats go to the debug output.
+	static void Optimize(GeometryGenerator::MeshData& meshData, bool overdraw);
+
+	//clusters receives the first triangle of every cluster the output can be split into without losing much locality
+	static void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, UINT cacheSize, std::vector<uint32_t>* clusters = nullptr);
+	//Reorders the clusters of a cache optimized list so that outward facing ones are drawn first
+	static void OptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<uint32_t>& clusters, const std::vector<GeometryGenerator::Vertex>& vertices);
+	//Vertices in first-use order over all index groups
+	static void OptimizeVertexFetch(GeometryGenerator::MeshData& meshData);
+
+	//FIFO cache simulation
+	static CacheStats AnalyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, UINT cacheSize);
+};
@@ -0,0 +1,22 @@
+#pragma once
+#include "stdafx.h"
+#include "Tools/GeometryGenerator.h"
+
+//Quadric error metric simplification (Garland-Heckbert) with half-edge collapses: a vertex is moved onto
+//a neighbour, so every level indexes the vertices of the base mesh. Vertices on borders, UV/normal seams
+//and material boundaries (positions shared by several IndicesGroups) never move.
+class MeshSimplifier
+{
+public:
+	static constexpr UINT kMaxLodLevels = 4;
+
+	//Appends up to levelCount coarser levels to meshData.lods, each with about half the triangles of the previous one.
+	//Stops early when the mesh cannot be reduced any further.
+	static void GenerateLods(GeometryGenerator::MeshData& meshData, UINT levelCount);
+
+	//Collapses edges until at most targetTriangleCount triangles remain or nothing can be collapsed.
+	//triangleGroups holds the IndicesGroup of every triangle and is compacted with indices.
+	//Returns the largest collapse error as an object space distance.
+	static float Simplify(const std::vector<GeometryGenerator::Vertex>& vertices, std::vector<uint32_t>& indices,
+		std::vector<uint32_t>& triangleGroups, size_t targetTriangleCount);
+};
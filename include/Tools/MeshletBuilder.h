@@ -0,0 +1,28 @@
+#pragma once
+#include "stdafx.h"
+#include <DirectXCollision.h>
+#include "Tools/GeometryGenerator.h"
+
+//Partitions index ranges into meshlets of consecutive triangles, so every meshlet stays a contiguous
+//index range that can be drawn on its own. Bounds and normal cones allow per-cluster culling on the CPU.
+class MeshletBuilder
+{
+public:
+	static constexpr UINT kMaxVertices = 64;
+	static constexpr UINT kMaxTriangles = 124;
+
+	struct IndexRange
+	{
+		UINT startIndexLocation;
+		UINT indexCount;
+	};
+
+	//indices point into vertices, startIndexLocation is the position of indices[0] in the index buffer
+	static void Build(const std::vector<GeometryGenerator::Vertex>& vertices, const uint32_t* indices, size_t indexCount,
+		UINT startIndexLocation, std::vector<Meshlet>& meshlets);
+
+	//Frustum and backface cone test in world space. Adjacent visible meshlets are merged into one range.
+	//Returns the number of culled meshlets.
+	static size_t Cull(const Meshlet* meshlets, size_t meshletCount, DirectX::FXMMATRIX world,
+		const DirectX::BoundingFrustum& frustum, DirectX::FXMVECTOR eyePos, std::vector<IndexRange>& ranges);
+};
@@ -0,0 +1,85 @@
+#pragma once
+#include "stdafx.h"
+#include <atomic>
+#include <memory>
+
+//Bounded lock-free queue for many producer threads and one consumer thread (Vyukov's bounded queue).
+//Every cell carries a sequence number: producers claim a position with one CAS and publish the cell by
+//bumping its sequence, the consumer frees the cell by advancing the sequence a full lap.
+template<typename T>
+class MpscRing
+{
+public:
+	//Capacity is rounded up to a power of two
+	explicit MpscRing(size_t capacity)
+	{
+		size_t size = 2;
+		while (size < capacity)
+			size <<= 1;
+		mMask = size - 1;
+		mCells.reset(new Cell[size]);
+		for (size_t i = 0; i < size; ++i)
+		{
+			mCells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+	MpscRing(const MpscRing&) = delete;
+	MpscRing& operator=(const MpscRing&) = delete;
+
+	//Any thread. False when the ring is full.
+	bool TryPush(const T& value)
+	{
+		size_t position = mEnqueuePosition.load(std::memory_order_relaxed);
+		Cell* cell;
+		for (;;)
+		{
+			cell = &mCells[position & mMask];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+			if (difference == 0)
+			{
+				//Cell is free for this lap, claim the position
+				if (mEnqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (difference < 0)
+			{
+				//The consumer has not freed the cell from the previous lap
+				return false;
+			}
+			else
+			{
+				position = mEnqueuePosition.load(std::memory_order_relaxed);
+			}
+		}
+		cell->value = value;
+		cell->sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+	//Consumer thread only. False when the ring is empty or the next cell is claimed but not written yet.
+	bool TryPop(T& value)
+	{
+		Cell& cell = mCells[mDequeuePosition & mMask];
+		size_t sequence = cell.sequence.load(std::memory_order_acquire);
+		if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(mDequeuePosition + 1) < 0)
+			return false;
+		value = std::move(cell.value);
+		cell.sequence.store(mDequeuePosition + mMask + 1, std::memory_order_release);
+		++mDequeuePosition;
+		return true;
+	}
+	size_t Capacity() const { return mMask + 1; }
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::unique_ptr<Cell[]> mCells;
+	size_t mMask = 0;
+	//Producers and the consumer on separate cache lines
+	alignas(64) std::atomic<size_t> mEnqueuePosition{ 0 };
+	alignas(64) size_t mDequeuePosition = 0;
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include "stdafx.h"
+#include <vector>
+
+class JobSystem;
+
+//Face corner as written in the file, fan-triangulated already.
+//Positive values are absolute OBJ indices (from 1), 0 is an absent index.
+//Negative (relative) indices are rebased to the chunk start and stored with kChunkRelativeBias added.
+struct ObjCorner
+{
+	int v;
+	int vt;
+	int vn;
+};
+//Grouping statements, replayed in file order during the merge.
+struct ObjStatement
+{
+	enum Type { Group, UseMtl, MtlLib };
+	Type type;
+	//Number of corners of this chunk that precede the statement
+	size_t cornerOffset;
+	std::string name;
+};
+//Everything parsed from one byte range of an OBJ file.
+struct ObjChunk
+{
+	std::vector<DirectX::XMFLOAT3> positions;
+	std::vector<DirectX::XMFLOAT2> texCoords;
+	std::vector<DirectX::XMFLOAT3> normals;
+	std::vector<ObjCorner> corners;
+	std::vector<ObjStatement> statements;
+};
+
+class ObjChunkParser
+{
+public:
+	static constexpr int kChunkRelativeBias = -(1 << 30);
+	//Ranges smaller than this are not worth a thread
+	static constexpr size_t kMinChunkBytes = 256 * 1024;
+
+	//Parse [begin, end) into one chunk per worker thread, chunks are returned in file order.
+	//Runs on jobs when given, on threads of its own otherwise.
+	static void Parse(const char* begin, const char* end, std::vector<ObjChunk>& chunks, JobSystem* jobs = nullptr);
+	//Parse a single range. Ranges must start at the beginning of a line.
+	static void ParseRange(const char* begin, const char* end, ObjChunk& chunk);
+
+	//Zero-based index into the merged attribute list, -1 when absent.
+	static int ResolveCorner(int index, size_t chunkBase)
+	{
+		if (index > 0)
+			return index - 1;
+		if (index < 0)
+			return static_cast<int>(chunkBase) + (index - kChunkRelativeBias);
+		return -1;
+	}
+private:
+	static std::vector<const char*> SplitOnLines(const char* begin, const char* end, size_t rangeCount);
+};
@@ -0,0 +1,103 @@
+#pragma once
+#include <charconv>
+#include <cstring>
+#include <string_view>
+
+//One line of an OBJ/MTL buffer. Tokens are views into the underlying bytes, nothing is allocated.
+struct ObjLine
+{
+	const char* cur = nullptr;
+	const char* end = nullptr;
+
+	static bool IsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+	void SkipSpaces()
+	{
+		while (cur < end && IsSpace(*cur))
+			++cur;
+	}
+	//Next whitespace separated token, empty when the line is exhausted
+	std::string_view NextToken()
+	{
+		SkipSpaces();
+		const char* begin = cur;
+		while (cur < end && !IsSpace(*cur))
+			++cur;
+		return std::string_view(begin, cur - begin);
+	}
+	//Remaining text with surrounding whitespace stripped (file names may contain spaces)
+	std::string_view Rest()
+	{
+		SkipSpaces();
+		const char* last = end;
+		while (last > cur && IsSpace(*(last - 1)))
+			--last;
+		return std::string_view(cur, last - cur);
+	}
+	bool NextFloat(float& value)
+	{
+		SkipSpaces();
+		//from_chars does not accept a leading '+'
+		if (cur < end && *cur == '+')
+			++cur;
+		auto result = std::from_chars(cur, end, value);
+		if (result.ec != std::errc())
+			return false;
+		cur = result.ptr;
+		return true;
+	}
+	//Face corner "v", "v/vt", "v//vn" or "v/vt/vn". Absent indices are returned as 0 (OBJ indices start from 1).
+	bool NextFaceCorner(int& v, int& vt, int& vn)
+	{
+		SkipSpaces();
+		v = vt = vn = 0;
+		auto result = std::from_chars(cur, end, v);
+		if (result.ec != std::errc())
+			return false;
+		cur = result.ptr;
+		if (cur < end && *cur == '/')
+		{
+			++cur;
+			if (cur < end && *cur != '/')
+			{
+				result = std::from_chars(cur, end, vt);
+				if (result.ec == std::errc())
+					cur = result.ptr;
+			}
+			if (cur < end && *cur == '/')
+			{
+				++cur;
+				result = std::from_chars(cur, end, vn);
+				if (result.ec == std::errc())
+					cur = result.ptr;
+			}
+		}
+		//Skip anything malformed up to the next separator
+		while (cur < end && !IsSpace(*cur))
+			++cur;
+		return true;
+	}
+};
+
+//Walks a memory mapped buffer line by line.
+class ObjTokenizer
+{
+public:
+	ObjTokenizer(const char* begin, const char* end) : mCurrent(begin), mEnd(end) {}
+
+	bool NextLine(ObjLine& line)
+	{
+		if (mCurrent >= mEnd)
+			return false;
+		const char* newLine = static_cast<const char*>(memchr(mCurrent, '\n', mEnd - mCurrent));
+		line.cur = mCurrent;
+		line.end = newLine != nullptr ? newLine : mEnd;
+		mCurrent = newLine != nullptr ? newLine + 1 : mEnd;
+		return true;
+	}
+private:
+	const char* mCurrent;
+	const char* mEnd;
+};
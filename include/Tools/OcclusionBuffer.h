@@ -0,0 +1,60 @@
+#pragma once
+#include "stdafx.h"
+#include <DirectXCollision.h>
+#include "Tools/JobSystem.h"
+
+//Low resolution software depth buffer for occlusion culling. A few occluder meshes are rasterized
+//four pixels at a time, split into horizontal bands that are filled by the job system. The max depth
+//of every 8x8 tile forms the coarse level that boxes are tested against: a box is hidden when its
+//nearest depth is behind the farthest occluder depth of every tile it covers.
+//
+//Depth is D3D's z/w in [0, 1], cleared to 1. Occluders touching the near plane are skipped and boxes
+//touching it are always visible, both keep the test conservative.
+class OcclusionBuffer
+{
+public:
+	static constexpr UINT kWidth = 256;
+	static constexpr UINT kHeight = 128;
+	static constexpr UINT kTileSize = 8;
+	static constexpr UINT kTilesX = kWidth / kTileSize;
+	static constexpr UINT kTilesY = kHeight / kTileSize;
+	static constexpr UINT kBands = 4;
+
+	struct Occluder
+	{
+		const DirectX::XMFLOAT3* positions = nullptr;
+		const uint32_t* indices = nullptr;
+		size_t indexCount = 0;
+		//Object to world, row vector convention
+		DirectX::XMFLOAT4X4 world;
+	};
+
+	OcclusionBuffer();
+
+	//Clears the depth and rasterizes the occluders seen through viewProj
+	void Render(const std::vector<Occluder>& occluders, DirectX::FXMMATRIX viewProj, JobSystem& jobs);
+	//False when the box is behind the occluders or off screen
+	bool IsVisible(const DirectX::BoundingBox& aabb) const;
+
+	float Depth(UINT x, UINT y) const { return mDepth[y * kWidth + x]; }
+	size_t TriangleCount() const { return mTriangles.size(); }
+
+private:
+	//Screen space triangle, counter-clockwise in pixel coordinates after setup
+	struct Triangle
+	{
+		float x[3];
+		float y[3];
+		float z[3];
+		float invArea;
+		int minX, maxX, minY, maxY;
+	};
+
+	void RasterizeBand(UINT band);
+	void BuildTiles(UINT band);
+
+	DirectX::XMFLOAT4X4 mViewProj;
+	std::vector<Triangle> mTriangles;
+	std::vector<float> mDepth;
+	std::vector<float> mTileMaxDepth;
+};
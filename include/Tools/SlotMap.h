@@ -0,0 +1,111 @@
+#pragma once
+#include "stdafx.h"
+
+//Handle into a SlotMap<T>. T only tags the handle type, it does not need to be complete here.
+template<typename T>
+struct SlotHandle
+{
+	static constexpr UINT kInvalidIndex = UINT_MAX;
+
+	UINT index = kInvalidIndex;
+	UINT generation = 0;
+
+	bool IsValid() const { return index != kInvalidIndex; }
+	bool operator==(const SlotHandle& rhs) const { return index == rhs.index && generation == rhs.generation; }
+	bool operator!=(const SlotHandle& rhs) const { return !(*this == rhs); }
+	bool operator<(const SlotHandle& rhs) const { return index != rhs.index ? index < rhs.index : generation < rhs.generation; }
+};
+
+//Values packed in one array, addressed through generational handles. A lookup is two array reads,
+//removing swaps the last value into the hole, and handles to removed values stop resolving.
+template<typename T>
+class SlotMap
+{
+public:
+	using Handle = SlotHandle<T>;
+
+	Handle Insert(T value)
+	{
+		UINT slot;
+		if (mFreeSlot != Handle::kInvalidIndex)
+		{
+			slot = mFreeSlot;
+			mFreeSlot = mSlots[slot].denseIndex;
+		}
+		else
+		{
+			slot = (UINT)mSlots.size();
+			mSlots.push_back({});
+		}
+		mSlots[slot].denseIndex = (UINT)mValues.size();
+		mValues.push_back(std::move(value));
+		mValueSlots.push_back(slot);
+
+		Handle handle;
+		handle.index = slot;
+		handle.generation = mSlots[slot].generation;
+		return handle;
+	}
+	bool Remove(Handle handle)
+	{
+		if (!Contains(handle))
+			return false;
+		Slot& slot = mSlots[handle.index];
+		UINT dense = slot.denseIndex;
+		UINT last = (UINT)mValues.size() - 1;
+		if (dense != last)
+		{
+			mValues[dense] = std::move(mValues[last]);
+			mValueSlots[dense] = mValueSlots[last];
+			mSlots[mValueSlots[dense]].denseIndex = dense;
+		}
+		mValues.pop_back();
+		mValueSlots.pop_back();
+		//Old handles to this slot no longer match
+		++slot.generation;
+		slot.denseIndex = mFreeSlot;
+		mFreeSlot = handle.index;
+		return true;
+	}
+	bool Contains(Handle handle) const
+	{
+		return handle.index < mSlots.size() && mSlots[handle.index].generation == handle.generation
+			&& mSlots[handle.index].denseIndex < mValues.size() && mValueSlots[mSlots[handle.index].denseIndex] == handle.index;
+	}
+	//nullptr for invalid or removed handles
+	T* Get(Handle handle) { return Contains(handle) ? &mValues[mSlots[handle.index].denseIndex] : nullptr; }
+	const T* Get(Handle handle) const { return Contains(handle) ? &mValues[mSlots[handle.index].denseIndex] : nullptr; }
+	void Clear()
+	{
+		for (UINT slot : mValueSlots)
+		{
+			++mSlots[slot].generation;
+			mSlots[slot].denseIndex = mFreeSlot;
+			mFreeSlot = slot;
+		}
+		mValues.clear();
+		mValueSlots.clear();
+	}
+
+	size_t Size() const { return mValues.size(); }
+	bool Empty() const { return mValues.empty(); }
+	//Dense order, changes when values are removed
+	typename std::vector<T>::iterator begin() { return mValues.begin(); }
+	typename std::vector<T>::iterator end() { return mValues.end(); }
+	typename std::vector<T>::const_iterator begin() const { return mValues.begin(); }
+	typename std::vector<T>::const_iterator end() const { return mValues.end(); }
+
+private:
+	struct Slot
+	{
+		//Position in mValues, or the next free slot while the slot is free
+		UINT denseIndex = Handle::kInvalidIndex;
+		UINT generation = 0;
+	};
+
+	std::vector<T> mValues;
+	//Slot of every value, to fix up the slot when its value is moved
+	std::vector<UINT> mValueSlots;
+	std::vector<Slot> mSlots;
+	UINT mFreeSlot = Handle::kInvalidIndex;
+};
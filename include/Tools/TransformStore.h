@@ -0,0 +1,41 @@
+#pragma once
+#include "stdafx.h"
+
+//Object transforms as parallel arrays indexed by transform id, arranged in a hierarchy. Moves only record
+//the new local scaling and motion and flag the transform. Update() walks the transforms in depth-first
+//order, parents before children, and recomposes the flagged ones together with their subtrees.
+//All matrices use the row vector convention, transpose them for HLSL.
+class TransformStore
+{
+public:
+	static constexpr UINT kNoParent = 0xFFFFFFFF;
+
+	//Identity transform below parent, which must already exist. Returns its index.
+	UINT Add(UINT parent = kNoParent);
+	//Keeps the local transform, the world follows the new parent. Ignored when it would create a cycle.
+	bool SetParent(UINT index, UINT parent);
+	UINT Parent(UINT index) const { return mParent[index]; }
+	size_t Size() const { return mWorld.size(); }
+
+	//local = scaling * rotation * translation, where scaling accumulates over moves and rotation * translation replaces the last one
+	void Move(UINT index, DirectX::FXMMATRIX scaling, DirectX::CXMMATRIX rotation, DirectX::CXMMATRIX translation);
+	//world = local * parent world for every moved transform and its descendants, their indices are appended to updated
+	void Update(std::vector<UINT>& updated);
+
+	DirectX::XMMATRIX World(UINT index) const { return DirectX::XMLoadFloat4x4(&mWorld[index]); }
+
+private:
+	void BuildOrder();
+
+	std::vector<DirectX::XMFLOAT4X4> mScaling;
+	std::vector<DirectX::XMFLOAT4X4> mMotion;
+	std::vector<DirectX::XMFLOAT4X4> mWorld;
+	std::vector<UINT> mParent;
+	std::vector<uint8_t> mDirty;
+	//Set while Update() runs for transforms whose world changed, read by their children
+	std::vector<uint8_t> mChanged;
+
+	//Depth-first order, rebuilt after the hierarchy changed. Transforms added in depth-first order keep it equal to the index order.
+	std::vector<UINT> mOrder;
+	bool mOrderDirty = false;
+};
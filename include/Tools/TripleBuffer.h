@@ -0,0 +1,44 @@
+#pragma once
+#include "stdafx.h"
+#include <atomic>
+
+//Hands the latest value from one producer thread to one consumer thread without locks or waiting. The
+//producer fills the write buffer and publishes it by swapping it with the middle one, the consumer takes
+//the middle one in exchange for its read buffer when a new value was published. Values the consumer was
+//too slow for are dropped, and neither side ever sees a buffer the other one is using.
+template<typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() = default;
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+	//Producer. Holds whatever was published two values ago, overwrite all of it.
+	T& WriteBuffer() { return mBuffers[mWrite]; }
+	void Publish()
+	{
+		mWrite = mMiddle.exchange(mWrite | kFresh, std::memory_order_acq_rel) & kIndexMask;
+	}
+
+	//Consumer. Moves to the latest published value, false when there was none since the last call.
+	bool Update()
+	{
+		if ((mMiddle.load(std::memory_order_relaxed) & kFresh) == 0)
+			return false;
+		mRead = mMiddle.exchange(mRead, std::memory_order_acq_rel) & kIndexMask;
+		return true;
+	}
+	const T& ReadBuffer() const { return mBuffers[mRead]; }
+
+private:
+	static constexpr unsigned kIndexMask = 3;
+	//Set on the middle index when it holds a value the consumer has not taken yet
+	static constexpr unsigned kFresh = 4;
+
+	T mBuffers[3];
+	//Owned by the producer and the consumer, the middle one is swapped between them
+	unsigned mWrite = 0;
+	unsigned mRead = 1;
+	std::atomic<unsigned> mMiddle{ 2 };
+};
@@ -0,0 +1,176 @@
+#pragma once
+#include "stdafx.h"
+#include <DirectXPackedVector.h>
+#include <cmath>
+#include <cstddef>
+#include "Tools/GeometryGenerator.h"
+
+//Compile-time vertex layouts. Every attribute descriptor knows its packed type, DXGI format and how to pack
+//one value, Layout<> combines them into the vertex struct, the packing loop and the input layout.
+//The default vertex shader decodes all of them (see ObjectConstants in D3D12Toy.h).
+namespace VertexFormat
+{
+	//Dequantization of positions, posL = packed * scale + bias. Identity for float positions.
+	struct PositionTransform
+	{
+		DirectX::XMFLOAT3 scale = DirectX::XMFLOAT3(1.0f, 1.0f, 1.0f);
+		DirectX::XMFLOAT3 bias = DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f);
+	};
+
+	inline uint16_t ToUNorm16(float v)
+	{
+		v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+		return static_cast<uint16_t>(v * 65535.0f + 0.5f);
+	}
+	inline int16_t ToSNorm16(float v)
+	{
+		v = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+		return static_cast<int16_t>(std::round(v * 32767.0f));
+	}
+	//Octahedral mapping of a unit vector onto [-1, 1]^2, used for normals and tangents
+	inline DirectX::XMFLOAT2 OctEncode(const DirectX::XMFLOAT3& n)
+	{
+		float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+		if (l1 <= 0.0f)
+			return DirectX::XMFLOAT2(0.0f, 0.0f);
+		float x = n.x / l1, y = n.y / l1;
+		if (n.z < 0.0f)
+		{
+			float ox = (1.0f - std::fabs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+			float oy = (1.0f - std::fabs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+			x = ox;
+			y = oy;
+		}
+		return DirectX::XMFLOAT2(x, y);
+	}
+
+	struct PositionFloat3
+	{
+		using Type = DirectX::XMFLOAT3;
+		static constexpr DXGI_FORMAT kFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+		static constexpr uint32_t kId = 1;
+		static constexpr bool kQuantized = false;
+		static Type Pack(const DirectX::XMFLOAT3& p, const PositionTransform&) { return p; }
+		static DirectX::XMFLOAT3 Unpack(const Type& p, const PositionTransform&) { return p; }
+	};
+	//16-bit normalized inside the bounds of the mesh, w is padding (no 3 component 16-bit format)
+	struct PositionUNorm16
+	{
+		struct Type { uint16_t x, y, z, w; };
+		static constexpr DXGI_FORMAT kFormat = DXGI_FORMAT_R16G16B16A16_UNORM;
+		static constexpr uint32_t kId = 2;
+		static constexpr bool kQuantized = true;
+		static Type Pack(const DirectX::XMFLOAT3& p, const PositionTransform& t)
+		{
+			return Type{
+				ToUNorm16(t.scale.x > 0.0f ? (p.x - t.bias.x) / t.scale.x : 0.0f),
+				ToUNorm16(t.scale.y > 0.0f ? (p.y - t.bias.y) / t.scale.y : 0.0f),
+				ToUNorm16(t.scale.z > 0.0f ? (p.z - t.bias.z) / t.scale.z : 0.0f),
+				0 };
+		}
+		static DirectX::XMFLOAT3 Unpack(const Type& p, const PositionTransform& t)
+		{
+			return DirectX::XMFLOAT3(
+				p.x / 65535.0f * t.scale.x + t.bias.x,
+				p.y / 65535.0f * t.scale.y + t.bias.y,
+				p.z / 65535.0f * t.scale.z + t.bias.z);
+		}
+	};
+	struct NormalFloat3
+	{
+		using Type = DirectX::XMFLOAT3;
+		static constexpr DXGI_FORMAT kFormat = DXGI_FORMAT_R32G32B32_FLOAT;
+		static constexpr uint32_t kId = 1;
+		static constexpr bool kOctahedral = false;
+		static Type Pack(const DirectX::XMFLOAT3& n) { return n; }
+	};
+	struct NormalOct16
+	{
+		struct Type { int16_t x, y; };
+		static constexpr DXGI_FORMAT kFormat = DXGI_FORMAT_R16G16_SNORM;
+		static constexpr uint32_t kId = 2;
+		static constexpr bool kOctahedral = true;
+		static Type Pack(const DirectX::XMFLOAT3& n)
+		{
+			DirectX::XMFLOAT2 e = OctEncode(n);
+			return Type{ ToSNorm16(e.x), ToSNorm16(e.y) };
+		}
+	};
+	struct TexCoordFloat2
+	{
+		using Type = DirectX::XMFLOAT2;
+		static constexpr DXGI_FORMAT kFormat = DXGI_FORMAT_R32G32_FLOAT;
+		static constexpr uint32_t kId = 1;
+		static Type Pack(const DirectX::XMFLOAT2& uv) { return uv; }
+	};
+	struct TexCoordHalf2
+	{
+		using Type = DirectX::PackedVector::XMHALF2;
+		static constexpr DXGI_FORMAT kFormat = DXGI_FORMAT_R16G16_FLOAT;
+		static constexpr uint32_t kId = 2;
+		static Type Pack(const DirectX::XMFLOAT2& uv) { return Type(uv.x, uv.y); }
+	};
+
+	template<class Position, class Normal, class TexCoord>
+	struct Layout
+	{
+		struct Vertex
+		{
+			typename Position::Type pos;
+			typename Normal::Type normal;
+			typename TexCoord::Type texCoordinate;
+		};
+		//Stored in the mesh cache so a cooked file of another layout is never reused
+		static constexpr uint32_t kId = Position::kId | (Normal::kId << 8) | (TexCoord::kId << 16);
+		static constexpr bool kQuantizedPosition = Position::kQuantized;
+		static constexpr bool kOctNormal = Normal::kOctahedral;
+
+		static std::vector<D3D12_INPUT_ELEMENT_DESC> InputLayout()
+		{
+			// SemanticName, SemanticIndex, Format, InputSlot,  AlignedByteOffset, InputSlotClass(PER VERTEX / INSTANCE), InstanceDataStepRate
+			return {
+				{ "POSITION", 0, Position::kFormat, 0, offsetof(Vertex, pos), D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+				{ "NORMAL", 0, Normal::kFormat, 0, offsetof(Vertex, normal), D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+				{ "TEXC", 0, TexCoord::kFormat, 0, offsetof(Vertex, texCoordinate), D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 }
+			};
+		}
+		//Bounds of the vertices for quantized positions, identity otherwise
+		static PositionTransform ComputeTransform(const std::vector<GeometryGenerator::Vertex>& vertices)
+		{
+			PositionTransform transform;
+			if (!kQuantizedPosition || vertices.empty())
+				return transform;
+			DirectX::XMVECTOR minimum = DirectX::XMLoadFloat3(&vertices[0].position);
+			DirectX::XMVECTOR maximum = minimum;
+			for (auto& v : vertices)
+			{
+				DirectX::XMVECTOR p = DirectX::XMLoadFloat3(&v.position);
+				minimum = DirectX::XMVectorMin(minimum, p);
+				maximum = DirectX::XMVectorMax(maximum, p);
+			}
+			DirectX::XMStoreFloat3(&transform.bias, minimum);
+			DirectX::XMStoreFloat3(&transform.scale, DirectX::XMVectorSubtract(maximum, minimum));
+			return transform;
+		}
+		static void Pack(const std::vector<GeometryGenerator::Vertex>& vertices, const PositionTransform& transform, std::vector<Vertex>& packed)
+		{
+			packed.resize(vertices.size());
+			for (size_t i = 0; i < vertices.size(); ++i)
+			{
+				packed[i].pos = Position::Pack(vertices[i].position, transform);
+				packed[i].normal = Normal::Pack(vertices[i].normal);
+				packed[i].texCoordinate = TexCoord::Pack(vertices[i].texCoordinate);
+			}
+		}
+		//Object space position as the vertex shader sees it
+		static DirectX::XMFLOAT3 UnpackPosition(const Vertex& vertex, const PositionTransform& transform)
+		{
+			return Position::Unpack(vertex.pos, transform);
+		}
+	};
+
+	//32 bytes, the original float layout
+	using FullLayout = Layout<PositionFloat3, NormalFloat3, TexCoordFloat2>;
+	//16 bytes
+	using CompactLayout = Layout<PositionUNorm16, NormalOct16, TexCoordHalf2>;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "stdafx.h"
+
+//Flat open-addressing table used to weld OBJ face corners into unique vertices.
+//Keys are the resolved (v, vt, vn) index triple, absent attributes are -1.
+//Linear probing over a power-of-two slot array, load factor kept under 1/2.
+class VertexWeldTable
+{
+public:
+	struct Stats
+	{
+		size_t lookups = 0;
+		size_t inserted = 0;
+		size_t totalProbes = 0;
+		size_t maxProbe = 0;
+	};
+
+	//Drop all keys, keeping enough room for expectedVertices without growing. Only the slots in use
+	//are cleared, so resetting per mesh costs the size of that mesh, not of the table.
+	void Reset(size_t expectedVertices = 0);
+	//Returns true when the triple is new. index receives the welded vertex, newIndex for new triples.
+	bool FindOrInsert(int v, int vt, int vn, uint32_t newIndex, uint32_t& index);
+
+	const Stats& GetStats() const { return mStats; }
+	void ResetStats() { mStats = Stats(); }
+	//Dedupe ratio and probe lengths to the debug output
+	void Report(const std::string& name) const;
+private:
+	static constexpr uint32_t kEmpty = 0xFFFFFFFF;
+	struct Slot
+	{
+		int v;
+		int vt;
+		int vn;
+		uint32_t index;
+	};
+	static size_t Hash(int v, int vt, int vn);
+	void Rehash(size_t slotCount);
+
+	std::vector<Slot> mSlots;
+	//Slots filled since the last Reset()
+	std::vector<size_t> mUsedSlots;
+	size_t mMask = 0;
+	size_t mCount = 0;
+	Stats mStats;
+};
@@ -16,6 +16,7 @@ D3DToy::D3DToy(UINT width, UINT height, std::wstring name) : DXSample(width, hei
 }
 D3DToy::~D3DToy()
 {
+	StopSimulation();
 	if (mDevice != nullptr)
 	{
 		FlushCommandQueue();
@@ -24,41 +25,72 @@ D3DToy::~D3DToy()
 
 void D3DToy::OnMouseMove(int xPos, int yPos, bool updatePos)
 {
-	mCam->OnMouseMove(xPos, yPos, updatePos);
+	CameraInput input;
+	input.type = CameraInput::Type::Move;
+	input.x = xPos;
+	input.y = yPos;
+	input.updatePos = updatePos;
+	PostCameraInput(input);
 }
 
 void D3DToy::OnZoom(short delta)
 {
-	mCam->OnZoom(delta);
+	CameraInput input;
+	input.type = CameraInput::Type::Zoom;
+	input.delta = delta;
+	PostCameraInput(input);
 }
 void D3DToy::OnKeyDown(UINT8 key)
 {
 	switch (key)
 	{
 	case 'S':
-		if (mCurrentInitialPSO == mPSOMap["triangle"])
-			mCurrentInitialPSO = mPSOMap["line"];
+		if (mCurrentInitialPSO == mTrianglePSO)
+			mCurrentInitialPSO = mLinePSO;
 		else
-			mCurrentInitialPSO = mPSOMap["triangle"];
+			mCurrentInitialPSO = mTrianglePSO;
+		break;
+	case 'C':
+		mClusterCulling = !mClusterCulling;
+		break;
+	case 'L':
+		mLodSelection = !mLodSelection;
+		break;
+	case 'F':
+		mFrustumCulling = !mFrustumCulling;
+		break;
+	case 'O':
+		mOcclusionCulling = !mOcclusionCulling;
+		break;
+	case '1':
+	case '2':
+	case '3':
+	case '4':
+		mFramePacer->SetFramesInFlight(key - '0');
+		//Slots the new depth reaches may hold stale material constants
+		for (auto& matItem : mMaterialItems)
+		{
+			matItem.numFramesDirty = FramePacer::kMaxFramesInFlight;
+		}
 		break;
 	case VK_UP:
 	{
 		ObjEvent event;
-		event.renderItem = mSpecialRenderItem;
+		event.transform = mModelTransform;
 		event.trans = XMMatrixIdentity();
 		event.rotation = XMMatrixIdentity();
 		event.scaling = XMMatrixScaling(2.0f, 2.0f, 2.0f);	
-		mObjEventQueue.push(event);
+		PostObjEvent(event);
 		break;
 	}
 	case VK_DOWN:
 	{
 		ObjEvent event;
-		event.renderItem = mSpecialRenderItem;
+		event.transform = mModelTransform;
 		event.trans = XMMatrixIdentity();
 		event.rotation = XMMatrixIdentity();
 		event.scaling = XMMatrixScaling(0.5f, 0.5f, 0.5f);
-		mObjEventQueue.push(event);
+		PostObjEvent(event);
 		break;
 	}
 	default:
@@ -75,6 +107,12 @@ void D3DToy::OnInit()
 	}
 #endif
 	DXSample::OnInit();
+//CPU culling benchmark, results in the debug output
+	if (m_cullBenchmark)
+		FrustumCuller::Benchmark(100000);
+//Frame pacer against a fake fence, results in the debug output
+	if (m_pacerSelfTest)
+		FramePacer::SelfTest();
 //Create Factory
 	ThrowIfFailed(CreateDXGIFactory1(IID_PPV_ARGS(&mFactory))); 
 //Create Adapter
@@ -89,6 +127,8 @@ void D3DToy::OnInit()
 	}
 //Create Fence
 	ThrowIfFailed(mDevice->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&mFence)));
+	mFenceWaiter = std::make_unique<D3D12FenceWaiter>(mFence.Get());
+	mFramePacer = std::make_unique<FramePacer>(*mFenceWaiter, m_framesInFlight);
 //Get Descriptor Size
 	mRTVDescSize = mDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
 	mDSVDescSize = mDevice->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_DSV);
@@ -123,66 +163,114 @@ void D3DToy::OnInit()
 	mCommandQueue->ExecuteCommandLists(_countof(cmdLists), cmdLists);
 //Wait until commands are finished
 	FlushCommandQueue();
+//First step runs here so there is always a snapshot to render, the rest on the simulation thread
+	mSimTimer.OnReset();
+	mSimWidth = mWidth;
+	mSimHeight = mHeight;
+	SimulateStep();
+	mSimThread = std::thread(&D3DToy::SimulationLoop, this);
 }
 //Update constant buffer
 void D3DToy::OnUpdate()
 {
 	DXSample::OnUpdate();
-	mCurrentFrameResIndex = (mCurrentFrameResIndex + 1) % numFrameResources;
+	//Blocks until the GPU finished the frame that last used these resources
+	mCurrentFrameResIndex = mFramePacer->BeginFrame();
 	mCurrentFrameRes = mFrameResources[mCurrentFrameResIndex].get();
-	//is set and has not reached this fence value
-	if (mCurrentFrameRes->fence != 0 && mFence->GetCompletedValue() < mCurrentFrameRes->fence)
-	{
-		HANDLE eventHandle = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
-		ThrowIfFailed(mFence->SetEventOnCompletion(mCurrentFrameRes->fence, eventHandle));
-		WaitForSingleObject(eventHandle, INFINITE);
-		CloseHandle(eventHandle);
-	}
-//Update obj constants 
-	for (auto& e : mRenderItems)
-	{
-		// Only update the cbuffer data if the constants have changed. 
-		// This needs to be tracked per frame resource.
-		if (e->numFramesDirty > 0)
-		{
-			// Update the constant buffer with the latest world matrix.
-			//Transpose->Row-major->column-major
-			ObjectConstants objConst;
-			XMMATRIX world = XMLoadFloat4x4(&e->world);
-
-			XMStoreFloat4x4(&objConst.world, XMMatrixTranspose(world));
-			mCurrentFrameRes->objCB->CopyData(e->objCBIndex, objConst);
-			--e->numFramesDirty;
-		}
-		if (e->id == "box")
-		{
-			ObjEvent event;
-			event.renderItem = e.get();
-			event.trans = XMMatrixTranslation(210 * cos(2 * mTimer.CurrentTime()), 100.0f, 210 * sin(2 * mTimer.CurrentTime()));
-			event.rotation = XMMatrixRotationY(mTimer.CurrentTime());
-			event.scaling = XMMatrixIdentity();
-			mObjEventQueue.push(event);
-		}
-	}
-	ProcessObjEvent();
+	mCommandListPool->BeginFrame(mCurrentFrameResIndex);
+	ConsumeSnapshot();
 //Update material constants
 	for (auto& e : mMaterialItems)
 	{
-		MaterialItem* matItem = e.second.get();
+		MaterialItem* matItem = &e;
 		if (matItem->numFramesDirty > 0)
 		{
 			mCurrentFrameRes->materialCB->CopyData(matItem->matCBIndex, matItem->matConsts);
 			--matItem->numFramesDirty;
 		}
 	}
-	//Update pass constants (pass, lights)
+	//Pass and light constants were computed by the simulation
+	XMMATRIX view = XMLoadFloat4x4(&mSnapshot->view);
+	XMMATRIX proj = XMLoadFloat4x4(&mSnapshot->proj);
+	XMMATRIX viewProj = XMMatrixMultiply(view, proj);
+	mCurrentFrameRes->passCB->CopyData(0, mSnapshot->pass);
+	mCurrentFrameRes->lightCB->CopyData(0, mSnapshot->lights);
+	mSceneBVH.Update();
+	if (mFrustumCulling)
+		QueryFrustumCandidates(view, proj, RenderLayer::Opaque, mFrustumCandidates);
+	else
+		mFrustumCandidates = mOpaqueRenderItems;
+	SelectLods(mFrustumCandidates, view, mSnapshot->pixelScale);
+	CullRenderItems(mFrustumCandidates, viewProj, mVisibleOpaqueRenderItems);
+	if (mOcclusionCulling)
+		CullOccluded(viewProj, mVisibleOpaqueRenderItems);
+	++mCullFrame;
+	if (mClusterCulling)
+		CullMeshlets(mVisibleOpaqueRenderItems, view, proj);
+	mInstanceCount = 0;
+	BuildInstanceBatches(mVisibleOpaqueRenderItems, RenderLayer::Opaque, view, mOpaqueBatches);
+	BuildInstanceBatches(mWireFrameRenderItems, RenderLayer::WireFrame, view, mWireFrameBatches);
+}
+void D3DToy::SimulateStep()
+{
+	mSimTimer.Tick();
+	float time = mSimTimer.CurrentTime();
+//Window input
+	CameraInput input;
+	while (mCameraInputQueue.TryPop(input))
+	{
+		switch (input.type)
+		{
+		case CameraInput::Type::Move:
+			mCam->OnMouseMove(input.x, input.y, input.updatePos);
+			break;
+		case CameraInput::Type::Zoom:
+			mCam->OnZoom(input.delta);
+			break;
+		case CameraInput::Type::Resize:
+			mSimWidth = static_cast<UINT>(input.x);
+			mSimHeight = static_cast<UINT>(input.y);
+			mCam->OnResize(mSimWidth, mSimHeight);
+			break;
+		}
+	}
+//Move objects
+	for (UINT transform : mAnimatedTransforms)
+	{
+		ObjEvent event;
+		event.transform = transform;
+		event.trans = XMMatrixTranslation(210 * cos(2 * time), 100.0f, 210 * sin(2 * time));
+		event.rotation = XMMatrixRotationY(time);
+		event.scaling = XMMatrixIdentity();
+		PostObjEvent(event);
+	}
+	ProcessObjEvent();
+	++mSimStep;
+	mTransformChangedSteps.resize(mTransforms.Size(), 0);
+	for (UINT transform : mUpdatedTransforms)
+	{
+		mTransformChangedSteps[transform] = mSimStep;
+	}
 
+	//Written buffer was published two steps ago, every field is overwritten
+	SimSnapshot& snapshot = mSnapshots.WriteBuffer();
+	snapshot.step = mSimStep;
+	snapshot.worlds.resize(mTransforms.Size());
+	for (UINT transform = 0; transform < mTransforms.Size(); ++transform)
+	{
+		XMStoreFloat4x4(&snapshot.worlds[transform], mTransforms.World(transform));
+	}
+	snapshot.changedSteps = mTransformChangedSteps;
+//Update pass constants (pass, lights)
 	XMMATRIX view, proj;
 	mCam->OnUpdate(view, proj);
 	XMMATRIX viewProj = XMMatrixMultiply(view, proj);
 	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
 	XMMATRIX invProj = XMMatrixInverse(&XMMatrixDeterminant(proj), proj);
 	XMMATRIX invViewProj = XMMatrixInverse(&XMMatrixDeterminant(viewProj), viewProj);
+	XMStoreFloat4x4(&snapshot.view, view);
+	XMStoreFloat4x4(&snapshot.proj, proj);
+	snapshot.pixelScale = 0.5f * mSimHeight / tanf(0.5f * mCam->mFOV);
 
 	XMStoreFloat4x4(&mMainPassConst.view, XMMatrixTranspose(view));
 	XMStoreFloat4x4(&mMainPassConst.inverseView, XMMatrixTranspose(invView));
@@ -193,93 +281,159 @@ void D3DToy::OnUpdate()
 
 	mMainPassConst.eyePosWorld = mCam->mPosition;
 
-	mMainPassConst.RTVSize = XMFLOAT2(mWidth, mHeight);
-	mMainPassConst.invRTVSize = XMFLOAT2(1.0f / mWidth, 1.0f / mHeight);
+	mMainPassConst.RTVSize = XMFLOAT2(mSimWidth, mSimHeight);
+	mMainPassConst.invRTVSize = XMFLOAT2(1.0f / mSimWidth, 1.0f / mSimHeight);
 
 	mMainPassConst.nearZ = mCam->nearZ;
 	mMainPassConst.farZ = mCam->farZ;
-	mMainPassConst.totalTime = mTimer.CurrentTime();
-
-	mCurrentFrameRes->passCB->CopyData(0, mMainPassConst);
+	mMainPassConst.totalTime = time;
+	snapshot.pass = mMainPassConst;
 //Update light constants
-	mLights.pointLights[0].position = XMFLOAT3(200 * cos(2 * mTimer.CurrentTime()), 100.0f, 200 * sin(2 * mTimer.CurrentTime()));//Between the cube and model
-	mCurrentFrameRes->lightCB->CopyData(0, mLights);
+	mLights.pointLights[0].position = XMFLOAT3(200 * cos(2 * time), 100.0f, 200 * sin(2 * time));//Between the cube and model
+	snapshot.lights = mLights;
+
+	mSnapshots.Publish();
+}
+void D3DToy::SimulationLoop()
+{
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mSimMutex);
+			mSimWake.wait(lock, [this]() { return mSimStop || mSimRequestedStep > mSimStep; });
+			if (mSimStop)
+				return;
+		}
+		SimulateStep();
+	}
+}
+void D3DToy::StopSimulation()
+{
+	if (!mSimThread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mSimMutex);
+		mSimStop = true;
+	}
+	mSimWake.notify_one();
+	mSimThread.join();
+}
+void D3DToy::ConsumeSnapshot()
+{
+	//Keeps the previous snapshot when the simulation has not finished the next step yet
+	mSnapshots.Update();
+	mSnapshot = &mSnapshots.ReadBuffer();
+	if (mSnapshot->step != mRenderedStep)
+	{
+		//Snapshots skipped in between are covered, changedSteps holds the last step that moved each transform
+		for (UINT transform = 0; transform < mSnapshot->changedSteps.size(); ++transform)
+		{
+			if (mSnapshot->changedSteps[transform] <= mRenderedStep)
+				continue;
+			XMMATRIX world = RenderWorld(transform);
+			for (auto ri : mTransformItems[transform])
+			{
+				UpdateWorldBounds(ri, world);
+			}
+		}
+		mRenderedStep = mSnapshot->step;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mSimMutex);
+		mSimRequestedStep = mRenderedStep + 1;
+	}
+	mSimWake.notify_one();
+}
+void D3DToy::PostCameraInput(const CameraInput& input)
+{
+	if (!mCameraInputQueue.TryPush(input))
+		OutputDebugStringA("Camera input dropped, input queue full\n");
 }
 void D3DToy::OnResize(UINT nWidth, UINT nHeight)
 {
 	DXSample::OnResize(nWidth, nHeight);
-	mCam->OnResize(mWidth, mHeight);
+	CameraInput input;
+	input.type = CameraInput::Type::Resize;
+	input.x = static_cast<int>(mWidth);
+	input.y = static_cast<int>(mHeight);
+	PostCameraInput(input);
 }
 void D3DToy::OnRender()
 {
-	//only reset when the associated command lists have finished execution on the GPU.
-	ThrowIfFailed(mCurrentFrameRes->cmdAllocator->Reset());
-	//command list can be reset after it has been added to the command queue 
+	//The pool recycled this frame's allocators in OnUpdate(), after the GPU finished with them
 	//set initial state(triangle) for next pass
-	ThrowIfFailed(mCommandList->Reset(mCurrentFrameRes->cmdAllocator.Get(), mCurrentInitialPSO.Get()));
-
-	mCommandList->RSSetViewports(1, &mCam->mViewport); //cannot specify multiple viewports to the same render target
-	mCommandList->RSSetScissorRects(1, &mCam->mScissorRect); //cannot specify multiple scissor rectangles on the same render target
+	ID3D12GraphicsCommandList* clearList = mCommandListPool->Acquire(mJobs.ThreadIndex(), mPSOs.Get(mCurrentInitialPSO)->Get());
+	UINT backBuffer = mSwapChain->GetCurrentBackBufferIndex();
 
 	//Indicate a state transition on the resource usage
-	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
-		mSwapChainBuffer[mSwapChain->GetCurrentBackBufferIndex()].Get(),
+	clearList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
+		mSwapChainBuffer[backBuffer].Get(),
 		D3D12_RESOURCE_STATE_PRESENT,
 		D3D12_RESOURCE_STATE_RENDER_TARGET));
 
 	//Clear back buffer and depth buffer
 	CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandle(
 		mRTVDescHeap->GetCPUDescriptorHandleForHeapStart(),
-		mSwapChain->GetCurrentBackBufferIndex(), // index to offset
+		backBuffer, // index to offset
 		mRTVDescSize // byte size of descriptor
 	);
 	CD3DX12_CPU_DESCRIPTOR_HANDLE dsvHandle(mDSVDescHeap->GetCPUDescriptorHandleForHeapStart());
-	mCommandList->ClearRenderTargetView(rtvHandle, grey, 0, nullptr);
-	mCommandList->ClearDepthStencilView(dsvHandle, D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
-
-	//Specify the render buffer
-	mCommandList->OMSetRenderTargets(1, &rtvHandle, true, &dsvHandle);
-
-	//Set Root signature
-	mCommandList->SetGraphicsRootSignature(mRootSignature.Get());
-	//Set CBV
-	ID3D12DescriptorHeap* descriptorHeaps[] = { mConstBufferDescHeap.Get() };
-	mCommandList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
-
-	//using root descriptor instead of descriptor heap for single object per pass
-	mCommandList->SetGraphicsRootConstantBufferView(2, mCurrentFrameRes->passCB->Resource()->GetGPUVirtualAddress());
-	mCommandList->SetGraphicsRootConstantBufferView(3, mCurrentFrameRes->lightCB->Resource()->GetGPUVirtualAddress());
-
-	DrawRenderItems(mCommandList.Get(), mOpaqueRenderItems);
-	//Change pipelinestate
-	mCommandList->SetPipelineState(mPSOMap["line"].Get());
-	DrawRenderItems(mCommandList.Get(), mWireFrameRenderItems);
+	clearList->ClearRenderTargetView(rtvHandle, grey, 0, nullptr);
+	clearList->ClearDepthStencilView(dsvHandle, D3D12_CLEAR_FLAG_DEPTH | D3D12_CLEAR_FLAG_STENCIL, 1.0f, 0, 0, nullptr);
+	ThrowIfFailed(clearList->Close());
+	mSubmitLists.assign(1, clearList);
+
+	//Opaque batches are split into contiguous chunks, each recorded into its own list on a worker.
+	//Chunks keep the sorted order, so executing the lists in order draws exactly what one list would.
+	size_t listCount = (mOpaqueBatches.size() + kDrawBatchGrain - 1) / kDrawBatchGrain;
+	listCount = (std::max)(static_cast<size_t>(1), (std::min)(listCount, static_cast<size_t>(mJobs.WorkerCount() + 1)));
+	size_t chunkSize = (mOpaqueBatches.size() + listCount - 1) / listCount;
+	mSubmitLists.resize(1 + listCount);
+	mJobs.ParallelFor(listCount, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t list = begin; list < end; ++list)
+		{
+			ID3D12GraphicsCommandList* drawList = BeginDrawList(rtvHandle, dsvHandle);
+			size_t first = (std::min)(list * chunkSize, mOpaqueBatches.size());
+			DrawRenderItems(drawList, mOpaqueBatches, first, (std::min)(first + chunkSize, mOpaqueBatches.size()));
+			//The last list also takes the wireframes and hands the back buffer to present
+			if (list == listCount - 1)
+			{
+				drawList->SetPipelineState(mPSOs.Get(mLinePSO)->Get());
+				DrawRenderItems(drawList, mWireFrameBatches, 0, mWireFrameBatches.size());
+				drawList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
+					mSwapChainBuffer[backBuffer].Get(),
+					D3D12_RESOURCE_STATE_RENDER_TARGET,
+					D3D12_RESOURCE_STATE_PRESENT));
+			}
+			ThrowIfFailed(drawList->Close());
+			mSubmitLists[1 + list] = drawList;
+		}
+	});
 
-	//State transition
-	mCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(
-		mSwapChainBuffer[mSwapChain->GetCurrentBackBufferIndex()].Get(),
-		D3D12_RESOURCE_STATE_RENDER_TARGET,
-		D3D12_RESOURCE_STATE_PRESENT));
-
-	//End Recording
-	mCommandList->Close();
-	//Add to Command queue
-	ID3D12CommandList* cmdLists[] = { mCommandList.Get() }; //Why?
-	mCommandQueue->ExecuteCommandLists(_countof(cmdLists), cmdLists);
+	//Add to Command queue, clears first and then the draw lists in order
+	mCommandQueue->ExecuteCommandLists((UINT)mSubmitLists.size(), mSubmitLists.data());
 	//Swap back and front buffer
 	ThrowIfFailed(mSwapChain->Present(0, 0)); //Parameter meaning?
 	//mCurrentBackBuffer = (mCurrentBackBuffer + 1) % mBufferCount;
 
 	//Waiting process transferred to frame resources OnUpdate()
 	++mCurrentFenceValue;
-	mCurrentFrameRes->fence = mCurrentFenceValue;
 	ThrowIfFailed(mCommandQueue->Signal(mFence.Get(), mCurrentFenceValue));
+	mFramePacer->EndFrame(mCurrentFenceValue);
 	//Wait commands to complete
 	//FlushCommandQueue();
 }
 void D3DToy::OnDestroy()
 {
-
+	StopSimulation();
+	if (mCommandListPool)
+	{
+		CommandListPool::Stats stats = mCommandListPool->GetStats();
+		OutputDebugStringA(("Command lists: " + std::to_string(stats.listCount) + " lists in " + std::to_string(stats.allocatorCount)
+			+ " allocators, peak " + std::to_string(stats.peakListsPerAllocator) + " per allocator, "
+			+ std::to_string(stats.peakListsPerFrame) + " per frame\n").c_str());
+	}
 }
 
 void D3DToy::CreateSwapChain()
@@ -318,6 +472,8 @@ void D3DToy::CreateCommandObjects()
 		nullptr, //Initial pipeline state object
 		IID_PPV_ARGS(&mCommandList) // Using GetAddressOf will Only Retrieve pointer without modifying ComPtr. & operator will release ComPtr
 	));// Node mask -> GPU ID?
+	//One allocator per frame in flight and per thread that records, the main thread included
+	mCommandListPool = std::make_unique<CommandListPool>(mDevice.Get(), FramePacer::kMaxFramesInFlight, mJobs.WorkerCount() + 1);
 
 	D3D12_COMMAND_QUEUE_DESC commandQueueDesc;
 	commandQueueDesc.NodeMask = 0;
@@ -396,20 +552,20 @@ void D3DToy::CreateRTVAndDSVDescHeap()
 }
 void D3DToy::CreateCBVAndSRVDescHeap()
 {
-	for (int i = 0; i < numFrameResources; ++i)
+	for (UINT i = 0; i < FramePacer::kMaxFramesInFlight; ++i)
 	{
-		mFrameResources.push_back(std::make_unique<FrameResource>(mDevice.Get(), 1, mRenderItems.size(), mMaterialItems.size()));
+		mFrameResources.push_back(std::make_unique<FrameResource>(mDevice.Get(), 1, mRenderItems.size(), mMaterialItems.Size()));
 	}
 	//Constant Buffer Figure
-	//ObjDataFrame11  ObjDataFrame3n | MaterialDataFrame 11  MaterialDataFrame 3n | ShaderResourceFrame11  ShaderResourceFrame3n
-	UINT objCount = (UINT)mRenderItems.size();//Changes from mOpaque to mRenderItems
-	UINT materialCount = (UINT)mMaterialItems.size();
-	mMaterialCbvOffset = objCount * numFrameResources;
-	mSRVOffset = mMaterialCbvOffset + materialCount * numFrameResources;
+	//MaterialDataFrame11 ... MaterialDataFrame3n | ShaderResource
+	//Instances are read through a root SRV, no per object CBVs
+	UINT materialCount = (UINT)mMaterialItems.Size();
+	mMaterialCbvOffset = 0;
+	mSRVOffset = mMaterialCbvOffset + materialCount * FramePacer::kMaxFramesInFlight;
 	//Constant Buffer descriptor heap
 	D3D12_DESCRIPTOR_HEAP_DESC cbvHeapDesc;
 	cbvHeapDesc.NodeMask = 0; // GPU ID?
-	cbvHeapDesc.NumDescriptors = numFrameResources * (objCount + materialCount) + mTextures.size();
+	cbvHeapDesc.NumDescriptors = FramePacer::kMaxFramesInFlight * materialCount + mTextures.Size();
 	cbvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
 	cbvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
 
@@ -417,27 +573,8 @@ void D3DToy::CreateCBVAndSRVDescHeap()
 
 	//Below for Creating different CBVs according to offset
 
-	//Constant buffer view (to each single object)
-	for (int frameIndex = 0; frameIndex < numFrameResources; ++frameIndex)
-	{
-		for (UINT objIndex = 0; objIndex < objCount; ++objIndex)
-		{
-			D3D12_GPU_VIRTUAL_ADDRESS cbAddress = mFrameResources[frameIndex]->objCB->Resource()->GetGPUVirtualAddress();
-			// Offset to the ith object constant buffer in the current buffer.
-			cbAddress += objIndex * objCBByteSize;
-			// Offset to the object CBV in the descriptor heap.
-			int heapIndex = frameIndex * objCount + objIndex;
-			auto handle = CD3DX12_CPU_DESCRIPTOR_HANDLE(
-				mConstBufferDescHeap->GetCPUDescriptorHandleForHeapStart());
-			handle.Offset(heapIndex, mCBVDescSize);
-			D3D12_CONSTANT_BUFFER_VIEW_DESC cbvDesc;
-			cbvDesc.BufferLocation = cbAddress;
-			cbvDesc.SizeInBytes = objCBByteSize;
-			mDevice->CreateConstantBufferView(&cbvDesc, handle);
-		}
-	}
 	//CBV for materials.
-	for (int frameIndex = 0; frameIndex < numFrameResources; ++frameIndex)
+	for (UINT frameIndex = 0; frameIndex < FramePacer::kMaxFramesInFlight; ++frameIndex)
 	{
 		for (UINT matIndex = 0; matIndex < materialCount; ++matIndex)
 		{
@@ -461,7 +598,7 @@ void D3DToy::CreateCBVAndSRVDescHeap()
 	for (auto& tex : mTextures)
 	{
 		D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
-		auto& texDesc = tex.second->resource->GetDesc();
+		auto& texDesc = tex.resource->GetDesc();
 		srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING; //default component order
 		srvDesc.Format = texDesc.Format;// Same as tex resource, compressed:DXGI_FORMAT_BC3_UNORM, etc
 		srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
@@ -469,13 +606,13 @@ void D3DToy::CreateCBVAndSRVDescHeap()
 		srvDesc.Texture2D.MipLevels = texDesc.MipLevels; //texture related
 		srvDesc.Texture2D.ResourceMinLODClamp = 0.0f;
 
-		tex.second->diffuseSRVHeapIndex = i++;
+		tex.diffuseSRVHeapIndex = i++;
 
 		CD3DX12_CPU_DESCRIPTOR_HANDLE srDescriptorHeap(
 			mConstBufferDescHeap->GetCPUDescriptorHandleForHeapStart());
-		int heapIndex = mSRVOffset + tex.second->diffuseSRVHeapIndex;
+		int heapIndex = mSRVOffset + tex.diffuseSRVHeapIndex;
 		srDescriptorHeap.Offset(heapIndex, mCBVDescSize);
-		mDevice->CreateShaderResourceView(tex.second->resource.Get(), &srvDesc, srDescriptorHeap);
+		mDevice->CreateShaderResourceView(tex.resource.Get(), &srvDesc, srDescriptorHeap);
 	}
 }
 void D3DToy::CreateSamplerDescHeap()
@@ -521,11 +658,11 @@ void D3DToy::CreateRootSignature()
 
 	// A root signature is an array of root parameters.
 	// Root parameter can be a table, root descriptor or root constants.
-	CD3DX12_ROOT_PARAMETER slotRootParameter[5] = {};
+	CD3DX12_ROOT_PARAMETER slotRootParameter[6] = {};
 	//Create a single descriptor table of CBVs
-	CD3DX12_DESCRIPTOR_RANGE cbvTable0 = {}, cbvTableMaterial = {}, srvTable = {};
-	cbvTable0.Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0); //Set baseShaderRegister 0 -> buffer0(b0)
-	slotRootParameter[0].InitAsDescriptorTable(1, &cbvTable0); //Num of descriptor range, descriptor range
+	CD3DX12_DESCRIPTOR_RANGE cbvTableMaterial = {}, srvTable = {};
+	//Instance structured buffer, t1
+	slotRootParameter[0].InitAsShaderResourceView(1, 0, D3D12_SHADER_VISIBILITY_VERTEX);
 
 	cbvTableMaterial.Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 1);//buffer 1
 	slotRootParameter[1].InitAsDescriptorTable(1, &cbvTableMaterial);//only one descriptor in this descriptor range
@@ -536,9 +673,11 @@ void D3DToy::CreateRootSignature()
 
 	srvTable.Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0); //srv buffer 0
 	slotRootParameter[4].InitAsDescriptorTable(1, &srvTable, D3D12_SHADER_VISIBILITY_PIXEL);// important
+	//First instance of the draw, b0. SV_InstanceID starts at 0 for every draw.
+	slotRootParameter[5].InitAsConstants(1, 0, 0, D3D12_SHADER_VISIBILITY_VERTEX);
 
 	CD3DX12_ROOT_SIGNATURE_DESC rootSigDesc(
-		5, 
+		6, 
 		slotRootParameter, 
 		mStaticSamplers.size(),
 		mStaticSamplers.data(),
@@ -568,23 +707,26 @@ void D3DToy::BuildGeoAndMat()
 	GeometryGenerator::MeshData box = geoGen.BuildBox(10.0f, 10.0f, 10.0f);
 	GeometryGenerator::MeshData grid = geoGen.BuildGrid(1000.0f, 1000.0f, 10, 10);
 
-	std::vector<GeometryGenerator::MeshData> objMeshes;
 	std::vector<MaterialLoader::Material> mtlList;
-	geoGen.ReadObjFile("assets\\models\\Homework\\Test", "Amber.obj", objMeshes, mtlList);
+	//Imported models own their buffers so a cooked mesh can be uploaded straight from the cache
+	MeshGeometry* model = LoadObjGeometry("assets\\models\\Homework\\Test", "Amber.obj", mtlList);
 
-	std::vector<Vertex> vertices;
-	std::vector<uint32_t> indices;
-	mGeometries = std::make_unique<MeshGeometry>();
-	mGeometries->Name = "Geometires";
+	std::vector<GeometryGenerator::Vertex> vertices;
+	std::vector<SceneIndex> indices;
+	auto shapes = std::make_unique<MeshGeometry>();
+	shapes->Name = "Geometires";
 
-	int renderItemOffset = 0;
 	UINT indexOffset = 0, vertexOffset = 0; //adjust in BuildSingleGeometry()
-	BuildSingleGeometry(mRenderItems, box, mGeometries.get(), vertices, vertexOffset, indices, indexOffset, 0, D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-	for (auto& mesh : objMeshes)
-	{
-		//Same objConstant buffer for now
-		BuildSingleGeometry(mRenderItems, mesh, mGeometries.get(), vertices, vertexOffset, indices, indexOffset, 1, D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-	}
+	BuildSingleGeometry(box, shapes.get(), vertices, vertexOffset, indices, indexOffset);
+	BuildSingleGeometry(grid, shapes.get(), vertices, vertexOffset, indices, indexOffset);
+
+	int renderItemOffset = 0;
+	UINT boxTransform = mTransforms.Add();
+	mAnimatedTransforms.push_back(boxTransform);
+	BuildRenderItems(mRenderItems, shapes.get(), 0, 1, boxTransform, D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	//One entity for the whole model
+	mModelTransform = mTransforms.Add();
+	BuildRenderItems(mRenderItems, model, 0, model->submeshes.size(), mModelTransform, D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 	//Dirty ways
 	mSpecialRenderItem = mRenderItems.back().get();
 
@@ -595,72 +737,108 @@ void D3DToy::BuildGeoAndMat()
 
 	//Draw linelist objects
 	renderItemOffset += mRenderItems.size();
-	BuildSingleGeometry(mRenderItems, grid, mGeometries.get(), vertices, vertexOffset, indices, indexOffset, 2, D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	BuildRenderItems(mRenderItems, shapes.get(), 1, 1, mTransforms.Add(), D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 	for (int i = renderItemOffset; i < mRenderItems.size(); ++i)
 	{
+		mRenderItems[i]->layer = RenderLayer::WireFrame;
 		mWireFrameRenderItems.push_back(mRenderItems[i].get());
 	}
+	mTransformItems.resize(mTransforms.Size());
+	for (auto& e : mRenderItems)
+	{
+		e->bvhProxy = mSceneBVH.CreateProxy(e->worldAabb, e.get());
+		mTransformItems[e->transform].push_back(e.get());
+	}
 
-	const UINT64 vbStride = sizeof(Vertex);
-	const UINT64 vbByteSize = vertices.size() * sizeof(Vertex);
-	const UINT ibByteSize = indices.size() * sizeof(uint32_t);
+	std::vector<SceneVertex> packed;
+	PackVertices(shapes.get(), vertices, packed);
+	//The ground hides whatever is below it, the model occludes with its coarsest LOD
+	ExtractOccluder(shapes.get(), packed.data(), indices.data(), 1, 1);
+	mOccluderItems.push_back(mWireFrameRenderItems.front());
+	if (!model->occluderIndices.empty())
+		mOccluderItems.push_back(mSpecialRenderItem);
 
-	//Set necessary info
-	mGeometries->vertexBufferByteSize = vbByteSize;
-	mGeometries->vertexByteStride = sizeof(Vertex);
-	mGeometries->indexFormat = DXGI_FORMAT_R32_UINT;
-	mGeometries->indexBufferByteSize = ibByteSize;
+	const UINT64 vbByteSize = packed.size() * sizeof(SceneVertex);
+	const UINT ibByteSize = indices.size() * sizeof(SceneIndex);
 
 	//Create resource on CPU
-	ThrowIfFailed(D3DCreateBlob(vbByteSize, &mGeometries->vertexBufferCPU));
-	CopyMemory(mGeometries->vertexBufferCPU->GetBufferPointer(), vertices.data(), vbByteSize);
-	ThrowIfFailed(D3DCreateBlob(ibByteSize, &mGeometries->indexBufferCPU));
-	CopyMemory(mGeometries->indexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
+	ThrowIfFailed(D3DCreateBlob(vbByteSize, &shapes->vertexBufferCPU));
+	CopyMemory(shapes->vertexBufferCPU->GetBufferPointer(), packed.data(), vbByteSize);
+	ThrowIfFailed(D3DCreateBlob(ibByteSize, &shapes->indexBufferCPU));
+	CopyMemory(shapes->indexBufferCPU->GetBufferPointer(), indices.data(), ibByteSize);
 
-	//Committed to default heap intermediately. IASetVertex/IndexBuffer indicates the interpting ways
-	CreateDefaultBuffer(mDevice.Get(), mCommandList.Get(), mGeometries->vertexBufferCPU->GetBufferPointer(), vbByteSize, mGeometries->vertexBufferGPU, mGeometries->vertexBufferUploader);
-	CreateDefaultBuffer(mDevice.Get(), mCommandList.Get(), mGeometries->indexBufferCPU->GetBufferPointer(), ibByteSize, mGeometries->indexBufferGPU, mGeometries->indexBufferUploader);
+	UploadGeometry(shapes.get(), shapes->vertexBufferCPU->GetBufferPointer(), vertices.size(), shapes->indexBufferCPU->GetBufferPointer(), indices.size());
+	mGeometries[shapes->Name] = std::move(shapes);
+
+	//Textures are decoded on the job system, creating and uploading them stays on this thread
+	std::vector<std::string> texturePaths;
+	for (auto& m : mtlList)
+	{
+		if (std::find(texturePaths.begin(), texturePaths.end(), m.texPath) == texturePaths.end())
+			texturePaths.push_back(m.texPath);
+	}
+	std::vector<MaterialLoader::Image> images(texturePaths.size());
+	mJobs.ParallelFor(texturePaths.size(), 1, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			images[i] = MaterialLoader::LoadImageFile(texturePaths[i]);
+		}
+	});
+	for (size_t i = 0; i < texturePaths.size(); ++i)
+	{
+		Texture tex;
+		MaterialLoader::CreateTextureFromImage(images[i], mDevice, mCommandList, tex.resource, tex.uploadHeap);
+		stbi_image_free(images[i].pixels);
+		mTextureHandles.emplace(texturePaths[i], mTextures.Insert(std::move(tex)));
+	}
 
 	//Materials
 	for (int i = 0; i < mtlList.size(); ++i)
 	{
 		auto& m = mtlList[i];
-		auto material = std::make_unique<MaterialItem>();
-		material->matCBIndex = i;
-		material->texPath = m.texPath;
-		material->matConsts.ambientAlbedo = XMFLOAT4(m.ka.x, m.ka.y, m.ka.z, 0.0f);
-		material->matConsts.diffuseAlbedo = XMFLOAT4(m.kd.x, m.kd.y, m.kd.z, 0.0f);
-		material->matConsts.specularAlbedo = XMFLOAT4(m.ks.x, m.ks.y, m.ks.z, 0.0f);
-		material->matConsts.refraction = m.ni;
-		material->matConsts.roughness = 1000.0f - min(1000.0f, m.ns); //transform to roughness.
-		material->matConsts.hasTexture = 1;
-
-		if (XMVector4Equal(XMLoadFloat4(&material->matConsts.ambientAlbedo), XMVectorZero()))
+		MaterialItem material;
+		material.matCBIndex = i;
+		material.texPath = m.texPath;
+		material.matConsts.ambientAlbedo = XMFLOAT4(m.ka.x, m.ka.y, m.ka.z, 0.0f);
+		material.matConsts.diffuseAlbedo = XMFLOAT4(m.kd.x, m.kd.y, m.kd.z, 0.0f);
+		material.matConsts.specularAlbedo = XMFLOAT4(m.ks.x, m.ks.y, m.ks.z, 0.0f);
+		material.matConsts.refraction = m.ni;
+		material.matConsts.roughness = 1000.0f - min(1000.0f, m.ns); //transform to roughness.
+		material.matConsts.hasTexture = 1;
+
+		if (XMVector4Equal(XMLoadFloat4(&material.matConsts.ambientAlbedo), XMVectorZero()))
 		{
-			material->matConsts.ambientAlbedo = material->matConsts.diffuseAlbedo;
+			material.matConsts.ambientAlbedo = material.matConsts.diffuseAlbedo;
 		}
-		if (XMVector4Equal(XMLoadFloat4(&material->matConsts.diffuseAlbedo), XMVectorZero()))
+		if (XMVector4Equal(XMLoadFloat4(&material.matConsts.diffuseAlbedo), XMVectorZero()))
 		{
-			material->matConsts.diffuseAlbedo = material->matConsts.ambientAlbedo;
+			material.matConsts.diffuseAlbedo = material.matConsts.ambientAlbedo;
 		}
 		//material->diffuseSRVHeapIndex
-		if (mTextures.find(material->texPath) == mTextures.end())
-		{
-			auto tex = std::make_unique<Texture>();
-			MaterialLoader::CreateTextureFromFile(material->texPath, mDevice, mCommandList, tex->resource, tex->uploadHeap);
-			mTextures.emplace(material->texPath, std::move(tex));
-		}
-		mMaterialItems.emplace(m.mtlName, std::move(material));
-	}
-	auto defaultMtl = std::make_unique<MaterialItem>();
-	defaultMtl->matCBIndex = mtlList.size();
-	defaultMtl->matConsts.ambientAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 0.0f);
-	defaultMtl->matConsts.diffuseAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 0.0f);
-	defaultMtl->matConsts.specularAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 0.0f);
-	defaultMtl->matConsts.refraction = 1.0f;
-	defaultMtl->matConsts.roughness = 1.0f; 
-	defaultMtl->matConsts.hasTexture = 0;
-	mMaterialItems.emplace("default", std::move(defaultMtl));
+		if (!material.texPath.empty())
+			material.texture = mTextureHandles.at(material.texPath);
+		mMaterialHandles.emplace(m.mtlName, mMaterialItems.Insert(std::move(material)));
+	}
+	MaterialItem defaultMtl;
+	defaultMtl.matCBIndex = mtlList.size();
+	defaultMtl.matConsts.ambientAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 0.0f);
+	defaultMtl.matConsts.diffuseAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 0.0f);
+	defaultMtl.matConsts.specularAlbedo = XMFLOAT4(1.0f, 1.0f, 1.0f, 0.0f);
+	defaultMtl.matConsts.refraction = 1.0f;
+	defaultMtl.matConsts.roughness = 1.0f; 
+	defaultMtl.matConsts.hasTexture = 0;
+	mMaterialHandles.emplace("default", mMaterialItems.Insert(std::move(defaultMtl)));
+
+	for (auto& e : mRenderItems)
+	{
+		e->material = FindMaterial(e->materialName);
+	}
+}
+D3DToy::MaterialHandle D3DToy::FindMaterial(const std::string& name) const
+{
+	auto it = mMaterialHandles.find(name);
+	return it != mMaterialHandles.end() ? it->second : mMaterialHandles.at("default");
 }
 void D3DToy::SetLights()
 {
@@ -678,12 +856,7 @@ void D3DToy::CreatePipelineStateObject()
 	//auto pixelShader = CompileShaderFromFile(L"src\\Shaders\\DefaultPixelShader.hlsl", nullptr, "PS", "ps_5_0");
 
 	//INput element Desc
-	std::vector<D3D12_INPUT_ELEMENT_DESC> inputLayout = {
-		// SemanticName, SemanticIndex, Format, InputSlot,  AlignedByteOffset, InputSlotClass(PER VERTEX / INSTANCE), InstanceDataStepRate
-			{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-			{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-			{ "TEXC", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 24, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0}
-	};
+	std::vector<D3D12_INPUT_ELEMENT_DESC> inputLayout = SceneVertexLayout::InputLayout();
 	D3D12_GRAPHICS_PIPELINE_STATE_DESC psoDesc;
 	ZeroMemory(&psoDesc, sizeof(D3D12_GRAPHICS_PIPELINE_STATE_DESC));
 	psoDesc.InputLayout = { inputLayout.data(), (UINT)inputLayout.size() };
@@ -704,75 +877,322 @@ void D3DToy::CreatePipelineStateObject()
 	psoDesc.SampleDesc.Count = mMsaa ? mMsaaSampleCount : 1;
 	psoDesc.SampleDesc.Quality = mMsaa ? (mMsaaQuality - 1) : 0;
 	psoDesc.DSVFormat = mDepthStencilBufferFormat;
-	ThrowIfFailed(mDevice->CreateGraphicsPipelineState(&psoDesc, IID_PPV_ARGS(&mPSOMap["triangle"])));
-	mCurrentInitialPSO = mPSOMap["triangle"];
+	ComPtr<ID3D12PipelineState> pso;
+	ThrowIfFailed(mDevice->CreateGraphicsPipelineState(&psoDesc, IID_PPV_ARGS(&pso)));
+	mTrianglePSO = mPSOs.Insert(pso);
+	mPSOHandles.emplace("triangle", mTrianglePSO);
+	mCurrentInitialPSO = mTrianglePSO;
 
 	//Grid PSO
 	psoDesc.PS = { gGridPixelShader, sizeof(gGridPixelShader) };
 	psoDesc.RasterizerState.FillMode = D3D12_FILL_MODE_WIREFRAME;
 	psoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
-	ThrowIfFailed(mDevice->CreateGraphicsPipelineState(&psoDesc, IID_PPV_ARGS(&mPSOMap["line"])));
+	ThrowIfFailed(mDevice->CreateGraphicsPipelineState(&psoDesc, IID_PPV_ARGS(&pso)));
+	mLinePSO = mPSOs.Insert(pso);
+	mPSOHandles.emplace("line", mLinePSO);
+}
+void D3DToy::BuildInstanceBatches(const std::vector<RenderItem*>& ritems, RenderLayer layer, FXMMATRIX view, std::vector<InstanceBatch>& batches)
+{
+	batches.clear();
+	mBatchedItems.clear();
+	for (auto ri : ritems)
+	{
+		if (ri->lodLevel == ri->selectedLod)
+			mBatchedItems.push_back(ri);
+	}
+	//Items issuing the same draw end up next to each other
+	auto drawKey = [](const RenderItem* ri)
+	{
+		return std::tie(ri->geo, ri->startIndexLocation, ri->indexCount, ri->baseVertexLocation, ri->primitiveType, ri->material);
+	};
+	std::sort(mBatchedItems.begin(), mBatchedItems.end(), [&drawKey](const RenderItem* a, const RenderItem* b)
+	{
+		return drawKey(a) < drawKey(b);
+	});
+
+	//Instances follow mBatchedItems, the batches are contiguous runs of it
+	const UINT firstInstance = mInstanceCount;
+	for (size_t i = 0; i < mBatchedItems.size(); ++i)
+	{
+		RenderItem* ri = mBatchedItems[i];
+		//Cluster culled items draw their own visible ranges, they cannot share a draw
+		bool clustered = IsClusterCulled(ri);
+		if (batches.empty() || clustered || drawKey(batches.back().first) != drawKey(ri))
+		{
+			InstanceBatch batch;
+			batch.first = ri;
+			batch.instanceBase = firstInstance + (UINT)i;
+			batches.push_back(batch);
+		}
+		++batches.back().instanceCount;
+	}
+	mJobs.ParallelFor(mBatchedItems.size(), kInstanceGrain, [&](size_t begin, size_t end)
+	{
+		ObjectConstants instance;
+		for (size_t i = begin; i < end; ++i)
+		{
+			RenderItem* ri = mBatchedItems[i];
+			XMStoreFloat4x4(&instance.world, XMMatrixTranspose(RenderWorld(ri->transform)));
+			SetVertexDecode(instance, ri->geo);
+			mCurrentFrameRes->instanceBuffer->CopyData(firstInstance + (UINT)i, instance);
+		}
+	});
+	mInstanceCount += (UINT)mBatchedItems.size();
+
+	mSortKeys.clear();
+	for (size_t i = 0; i < batches.size(); ++i)
+	{
+		RenderItem* ri = batches[i].first;
+		const MaterialItem* mat = mMaterialItems.Get(ri->material);
+		UINT texture = mat->texture.IsValid() ? mTextures.Get(mat->texture)->diffuseSRVHeapIndex : DrawSortKey::kNoTexture;
+		//View depth of the first instance stands for the batch
+		float depth = XMVectorGetZ(XMVector3TransformCoord(XMLoadFloat3(&ri->worldSphere.Center), view)) / mSnapshot->pass.farZ;
+		//One root signature for every PSO
+		mSortKeys.push_back({ DrawSortKey::Pack(static_cast<UINT>(layer), 0, mat->matCBIndex, texture, ri->geoSortId, depth), (UINT)i });
+	}
+	DrawSortKey::RadixSort(mSortKeys, mSortScratch);
+	mSortedBatches.clear();
+	for (const DrawSortKey::Entry& entry : mSortKeys)
+	{
+		mSortedBatches.push_back(batches[entry.index]);
+	}
+	batches.swap(mSortedBatches);
+}
+ID3D12GraphicsCommandList* D3DToy::BeginDrawList(D3D12_CPU_DESCRIPTOR_HANDLE rtvHandle, D3D12_CPU_DESCRIPTOR_HANDLE dsvHandle)
+{
+	ID3D12GraphicsCommandList* drawList = mCommandListPool->Acquire(mJobs.ThreadIndex(), mPSOs.Get(mCurrentInitialPSO)->Get());
+
+	//Nothing carries over between command lists
+	drawList->RSSetViewports(1, &mCam->mViewport);
+	drawList->RSSetScissorRects(1, &mCam->mScissorRect);
+	drawList->OMSetRenderTargets(1, &rtvHandle, true, &dsvHandle);
+
+	drawList->SetGraphicsRootSignature(mRootSignature.Get());
+	ID3D12DescriptorHeap* descriptorHeaps[] = { mConstBufferDescHeap.Get() };
+	drawList->SetDescriptorHeaps(_countof(descriptorHeaps), descriptorHeaps);
+	//using root descriptor instead of descriptor heap for single object per pass
+	drawList->SetGraphicsRootConstantBufferView(2, mCurrentFrameRes->passCB->Resource()->GetGPUVirtualAddress());
+	drawList->SetGraphicsRootConstantBufferView(3, mCurrentFrameRes->lightCB->Resource()->GetGPUVirtualAddress());
+	drawList->SetGraphicsRootShaderResourceView(0, mCurrentFrameRes->instanceBuffer->Resource()->GetGPUVirtualAddress());
+	return drawList;
 }
-void D3DToy::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<RenderItem*>& ritems)
+void D3DToy::DrawRenderItems(ID3D12GraphicsCommandList* cmdList, const std::vector<InstanceBatch>& batches, size_t begin, size_t end)
 {
 	CD3DX12_GPU_DESCRIPTOR_HANDLE cbvHandle(
 		mConstBufferDescHeap->GetGPUDescriptorHandleForHeapStart());
 	CD3DX12_GPU_DESCRIPTOR_HANDLE handle = {};
-	for (size_t i = 0; i < ritems.size(); ++i)
+	//State set by the previous batch, batches come sorted so most of it carries over
+	const MeshGeometry* currentGeo = nullptr;
+	D3D12_PRIMITIVE_TOPOLOGY currentTopology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
+	int currentMaterial = -1, currentTexture = -1;
+	for (size_t i = begin; i < end; ++i)
 	{
-		auto ri = ritems[i];
-		cmdList->IASetVertexBuffers(0, 1, &ri->geo->VertexBufferView());
-		cmdList->IASetIndexBuffer(&ri->geo->IndexBufferView());
-		cmdList->IASetPrimitiveTopology(ri->primitiveType);
-		// Offset to the CBV in the descriptor heap for this object and
-		// for this frame resource.
-
-		UINT cbvIndex = mCurrentFrameResIndex * mRenderItems.size() + ri->objCBIndex; //Changes from mOpaque to mRender
-		handle.InitOffsetted(cbvHandle, cbvIndex, mCBVDescSize);
-		cmdList->SetGraphicsRootDescriptorTable(0, handle);//CB
+		const InstanceBatch& batch = batches[i];
+		auto ri = batch.first;
+		if (ri->geo != currentGeo)
+		{
+			cmdList->IASetVertexBuffers(0, 1, &ri->geo->VertexBufferView());
+			cmdList->IASetIndexBuffer(&ri->geo->IndexBufferView());
+			currentGeo = ri->geo;
+		}
+		if (ri->primitiveType != currentTopology)
+		{
+			cmdList->IASetPrimitiveTopology(ri->primitiveType);
+			currentTopology = ri->primitiveType;
+		}
+		cmdList->SetGraphicsRoot32BitConstant(5, batch.instanceBase, 0);
 
-		auto& mat = mMaterialItems[ri->materialName];
-		//Should follow the sequency in CreateCBV? (All objCB, then matCB)
-		UINT matCBVIndex = mMaterialCbvOffset + mCurrentFrameResIndex * mMaterialItems.size() + mat->matCBIndex;
-		handle.InitOffsetted(cbvHandle, matCBVIndex, mCBVDescSize);
-		cmdList->SetGraphicsRootDescriptorTable(1, handle);
+		const MaterialItem* mat = mMaterialItems.Get(ri->material);
+		int matCBVIndex = mMaterialCbvOffset + mCurrentFrameResIndex * mMaterialItems.Size() + mat->matCBIndex;
+		if (matCBVIndex != currentMaterial)
+		{
+			handle.InitOffsetted(cbvHandle, matCBVIndex, mCBVDescSize);
+			cmdList->SetGraphicsRootDescriptorTable(1, handle);
+			currentMaterial = matCBVIndex;
+		}
 
 		//Shader Resource Buffer
-		if (!mat->texPath.empty())
+		if (mat->texture.IsValid())
 		{
-			int heapIndex = mSRVOffset + mTextures[mat->texPath]->diffuseSRVHeapIndex;
-			handle.InitOffsetted(cbvHandle, heapIndex, mCBVDescSize);
-			cmdList->SetGraphicsRootDescriptorTable(4, handle);
+			int heapIndex = mSRVOffset + mTextures.Get(mat->texture)->diffuseSRVHeapIndex;
+			if (heapIndex != currentTexture)
+			{
+				handle.InitOffsetted(cbvHandle, heapIndex, mCBVDescSize);
+				cmdList->SetGraphicsRootDescriptorTable(4, handle);
+				currentTexture = heapIndex;
+			}
 		}
 
-		cmdList->DrawIndexedInstanced(ri->indexCount, 1,
+		if (IsClusterCulled(ri))
+		{
+			//Only what survived CullMeshlets()
+			for (auto& range : ri->visibleRanges)
+			{
+				cmdList->DrawIndexedInstanced(range.indexCount, batch.instanceCount,
+					range.startIndexLocation, ri->baseVertexLocation, 0);
+			}
+			continue;
+		}
+		cmdList->DrawIndexedInstanced(ri->indexCount, batch.instanceCount,
 			ri->startIndexLocation, ri->baseVertexLocation, 0);//VB IB
 	}
 }
-void D3DToy::ProcessObjEvent()
+void D3DToy::CullMeshlets(const std::vector<RenderItem*>& ritems, FXMMATRIX view, CXMMATRIX proj)
 {
-	std::lock_guard<std::mutex> lock(mEventQueueMutex);
-	while (!mObjEventQueue.empty())
-	{
-		ObjEvent e = mObjEventQueue.front();
-		mObjEventQueue.pop();
-
-		ObjectConstants objConst;
-		XMMATRIX world = XMMatrixIdentity();
-
-		world = XMMatrixMultiply(e.trans, world);
-		world = XMMatrixMultiply(e.rotation, world);
+	//World space frustum
+	BoundingFrustum frustum;
+	BoundingFrustum::CreateFromMatrix(frustum, proj);
+	XMMATRIX invView = XMMatrixInverse(&XMMatrixDeterminant(view), view);
+	frustum.Transform(frustum, invView);
+	XMVECTOR eyePos = invView.r[3];
 
-		XMMATRIX scaling = XMMatrixMultiply(e.scaling, XMLoadFloat4x4(&e.renderItem->scaling));
-		XMStoreFloat4x4(&e.renderItem->scaling, XMMatrixTranspose(scaling));
+	//Items only write their own visibleRanges
+	mJobs.ParallelFor(ritems.size(), kMeshletCullGrain, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			RenderItem* ri = ritems[i];
+			if (ri->meshletCount == 0 || ri->lodLevel != ri->selectedLod)
+				continue;
+			ri->meshletCullFrame = mCullFrame;
+			//Whole submesh outside, no need to look at its meshlets
+			if (!frustum.Intersects(ri->worldAabb))
+			{
+				ri->visibleRanges.clear();
+				continue;
+			}
+			XMMATRIX world = RenderWorld(ri->transform);
+			MeshletBuilder::Cull(&ri->geo->meshlets[ri->firstMeshlet], ri->meshletCount, world, frustum, eyePos, ri->visibleRanges);
+		}
+	});
+}
+void D3DToy::QueryFrustumCandidates(FXMMATRIX view, CXMMATRIX proj, RenderLayer layer, std::vector<RenderItem*>& candidates)
+{
+	candidates.clear();
+	BoundingFrustum frustum;
+	BoundingFrustum::CreateFromMatrix(frustum, proj);
+	frustum.Transform(frustum, XMMatrixInverse(&XMMatrixDeterminant(view), view));
+	mSceneBVH.QueryFrustum(frustum, [&](void* userData)
+	{
+		RenderItem* ri = static_cast<RenderItem*>(userData);
+		if (ri->layer == layer)
+			candidates.push_back(ri);
+	});
+}
+void D3DToy::CullRenderItems(const std::vector<RenderItem*>& ritems, FXMMATRIX viewProj, std::vector<RenderItem*>& visible)
+{
+	visible.clear();
+	mFrustumCuller.SetViewProj(viewProj);
+	mFrustumCuller.Clear();
+	//visible doubles as the culler index -> item table
+	for (auto ri : ritems)
+	{
+		if (ri->lodLevel != ri->selectedLod)
+			continue;
+		visible.push_back(ri);
+		mFrustumCuller.Add(ri->worldAabb);
+	}
+	if (!mFrustumCulling)
+		return;
 
-		world = XMMatrixMultiply(scaling, world);
+	mVisibleIndices.clear();
+	mFrustumCuller.Cull(mVisibleIndices);
+	//Indices are ascending, compacting in place is safe
+	for (size_t i = 0; i < mVisibleIndices.size(); ++i)
+	{
+		visible[i] = visible[mVisibleIndices[i]];
+	}
+	visible.resize(mVisibleIndices.size());
+}
+void D3DToy::CullOccluded(FXMMATRIX viewProj, std::vector<RenderItem*>& visible)
+{
+	mOccluders.clear();
+	for (auto ri : mOccluderItems)
+	{
+		OcclusionBuffer::Occluder occluder;
+		occluder.positions = ri->geo->occluderPositions.data();
+		occluder.indices = ri->geo->occluderIndices.data();
+		occluder.indexCount = ri->geo->occluderIndices.size();
+		XMStoreFloat4x4(&occluder.world, RenderWorld(ri->transform));
+		mOccluders.push_back(occluder);
+	}
+	mOcclusionBuffer.Render(mOccluders, viewProj, mJobs);
 
-		XMStoreFloat4x4(&e.renderItem->world, XMMatrixTranspose(world));
-		XMStoreFloat4x4(&objConst.world, XMMatrixTranspose(world));
-		mCurrentFrameRes->objCB->CopyData(e.renderItem->objCBIndex, objConst);
-		e.renderItem->numFramesDirty = numFrameResources - 1;
+	//An item's own LOD lies inside its box and never hides it
+	size_t count = 0;
+	for (auto ri : visible)
+	{
+		if (mOcclusionBuffer.IsVisible(ri->worldAabb))
+			visible[count++] = ri;
+	}
+	visible.resize(count);
+}
+void D3DToy::SelectLods(const std::vector<RenderItem*>& ritems, FXMMATRIX view, float pixelScale)
+{
+	for (auto ri : ritems)
+	{
+		ri->selectedLod = 0;
+		if (!mLodSelection || ri->lodCount <= 1)
+			continue;
+		const MeshGeometry* geo = ri->geo;
+		XMMATRIX world = RenderWorld(ri->transform);
+		float scale = XMVectorGetX(XMVector3LengthSq(world.r[0]));
+		scale = (std::fmax)(scale, XMVectorGetX(XMVector3LengthSq(world.r[1])));
+		scale = (std::fmax)(scale, XMVectorGetX(XMVector3LengthSq(world.r[2])));
+		scale = sqrtf(scale);
+
+		//Closest point of the bounding sphere, inside it only the full mesh is safe
+		XMVECTOR center = XMVector3TransformCoord(XMLoadFloat3(&geo->boundsCenter), XMMatrixMultiply(world, view));
+		float distance = XMVectorGetX(XMVector3Length(center)) - geo->boundsRadius * scale;
+		if (distance <= 0.0f)
+			continue;
+		UINT levels = (std::min)(ri->lodCount, (UINT)geo->lodErrors.size());
+		for (UINT level = levels - 1; level > 0; --level)
+		{
+			if (geo->lodErrors[level] * scale * pixelScale / distance <= kLodPixelError)
+			{
+				ri->selectedLod = level;
+				break;
+			}
+		}
+	}
+}
+void D3DToy::PostObjEvent(const ObjEvent& event)
+{
+	//Only fills up when nothing drained it for many frames
+	if (!mObjEventQueue.TryPush(event))
+		OutputDebugStringA("Object event dropped, event queue full\n");
+}
+void D3DToy::ProcessObjEvent()
+{
+	//Events of one transform collapse into one move: scalings multiply, the last motion wins
+	mPendingEventIndex.resize(mTransforms.Size(), kNoPendingEvent);
+	ObjEvent e;
+	while (mObjEventQueue.TryPop(e))
+	{
+		UINT& pending = mPendingEventIndex[e.transform];
+		if (pending == kNoPendingEvent)
+		{
+			pending = (UINT)mPendingEvents.size();
+			mPendingEvents.push_back(e);
+			continue;
+		}
+		ObjEvent& merged = mPendingEvents[pending];
+		merged.scaling = XMMatrixMultiply(e.scaling, merged.scaling);
+		merged.rotation = e.rotation;
+		merged.trans = e.trans;
+	}
+	for (auto& merged : mPendingEvents)
+	{
+		mTransforms.Move(merged.transform, merged.scaling, merged.rotation, merged.trans);
+		mPendingEventIndex[merged.transform] = kNoPendingEvent;
 	}
+	mPendingEvents.clear();
+
+	//Several moves in the hierarchy recompose each transform once
+	//Bounds follow on the render thread, see ConsumeSnapshot()
+	mUpdatedTransforms.clear();
+	mTransforms.Update(mUpdatedTransforms);
 }
 void D3DToy::CheckFeatureSupport()
 {
@@ -817,60 +1237,285 @@ void D3DToy::FlushCommandQueue() //in other words, wait Commands to be excuted c
 
 	// Wait until GPU completes.
 	if (mFence->GetCompletedValue() < mCurrentFenceValue)
-	{
-		HANDLE eventHandle = CreateEventEx(nullptr, false, false, EVENT_ALL_ACCESS);
-		ThrowIfFailed(mFence->SetEventOnCompletion(mCurrentFenceValue, eventHandle));
-		WaitForSingleObject(eventHandle, INFINITE);
-		CloseHandle(eventHandle);
-	}
+		mFenceWaiter->Wait(mCurrentFenceValue);
 }
 
-void D3DToy::BuildSingleGeometry(std::vector<std::unique_ptr<RenderItem>>& riList,
-	GeometryGenerator::MeshData& meshData,
+void D3DToy::BuildSingleGeometry(GeometryGenerator::MeshData& meshData,
 	MeshGeometry* geometry, 
-	std::vector<Vertex>& vertices, UINT& vertexOffset, 
-	std::vector<uint32_t>& indices, UINT& indexOffset,
-	int objCBIndex, D3D12_PRIMITIVE_TOPOLOGY topology)
+	std::vector<GeometryGenerator::Vertex>& vertices, UINT& vertexOffset, 
+	std::vector<SceneIndex>& indices, UINT& indexOffset)
 {
-	for (size_t i = 0; i < meshData.vertices.size(); ++i) //
+	//Level 0 followed by the simplified levels, all of them index the same vertices
+	std::vector<std::vector<GeometryGenerator::IndicesGroup>*> levels = { &meshData.idxGroups };
+	for (auto& lod : meshData.lods)
 	{
-		Vertex v;
-		v.pos = meshData.vertices[i].position;
-		v.normal = meshData.vertices[i].normal;
-		v.texCoordinate = meshData.vertices[i].texCoordinate;
-		//v.texCoordinate.y = 1 - v.texCoordinate.y; // ? v.texCoordinate.y *= -1
-		vertices.push_back(v);
+		levels.push_back(&lod.idxGroups);
 	}
 
-	for (auto& e : meshData.idxGroups)
+	//Split first, oversized triangles may add vertices to the mesh
+	std::vector<std::vector<std::vector<IndexPacker::Range>>> groupRanges(levels.size());
+	for (size_t level = 0; level < levels.size(); ++level)
 	{
-		//Set submesh
-		SubmeshGeometry submesh;
-		submesh.indexCount = e.indices.size();
-		//indexOffset in buffer
-		submesh.startIndexLocation = indexOffset;
-		//vertexOffset in buffer
-		submesh.baseVertexLocation = vertexOffset;
-
-		indices.insert(indices.end(), e.indices.begin(), e.indices.end());
-
-		std::string subMeshName = meshData.name + "_" + e.mtlName;
+		auto& groups = *levels[level];
+		groupRanges[level].resize(groups.size());
+		for (size_t i = 0; i < groups.size(); ++i)
+		{
+			IndexPacker::Split(groups[i].indices, meshData.vertices, groupRanges[level][i]);
+		}
+	}
 
-		geometry->drawArgs[subMeshName] = submesh;
+	//Packed to SceneVertex once the whole buffer is known, see PackVertices()
+	vertices.insert(vertices.end(), meshData.vertices.begin(), meshData.vertices.end());
 
+	for (size_t level = 0; level < levels.size(); ++level)
+	{
+		auto& groups = *levels[level];
+		for (size_t i = 0; i < groups.size(); ++i)
+		{
+			auto& e = groups[i];
+			//One submesh per 16-bit range, a group larger than 65536 vertices gets several with the same names
+			for (auto& range : groupRanges[level][i])
+			{
+				//Set submesh
+				SubmeshGeometry submesh;
+				submesh.meshName = meshData.name;
+				submesh.materialName = e.mtlName;
+				submesh.indexCount = (UINT)range.indexCount;
+				//indexOffset in buffer
+				submesh.startIndexLocation = indexOffset;
+				//vertexOffset in buffer, rebased to the range
+				submesh.baseVertexLocation = vertexOffset + range.baseVertex;
+				submesh.lodLevel = (UINT)level;
+				submesh.lodCount = (UINT)levels.size();
+
+				IndexPacker::Pack(e.indices, range, indices);
+				GeometryGenerator::ComputeBounds(meshData.vertices, e.indices.data() + range.firstIndex, range.indexCount,
+					submesh.aabb, submesh.sphere);
+
+				submesh.firstMeshlet = (UINT)geometry->meshlets.size();
+				MeshletBuilder::Build(meshData.vertices, e.indices.data() + range.firstIndex, range.indexCount,
+					submesh.startIndexLocation, geometry->meshlets);
+				submesh.meshletCount = (UINT)geometry->meshlets.size() - submesh.firstMeshlet;
+
+				//Only level 0 is looked up by name
+				if (level == 0)
+				{
+					std::string subMeshName = meshData.name + "_" + e.mtlName;
+					geometry->drawArgs[subMeshName] = submesh;
+				}
+				geometry->submeshes.push_back(submesh);
+
+				indexOffset += (UINT)submesh.indexCount;
+			}
+		}
+	}
+	vertexOffset += (UINT)meshData.vertices.size();
+}
+void D3DToy::BuildRenderItems(std::vector<std::unique_ptr<RenderItem>>& riList, MeshGeometry* geometry,
+	size_t firstSubmesh, size_t submeshCount, UINT entityTransform, D3D12_PRIMITIVE_TOPOLOGY topology)
+{
+	//LOD levels and material splits of a mesh keep its name
+	std::unordered_map<std::string, UINT> meshTransforms;
+	for (size_t i = firstSubmesh; i < firstSubmesh + submeshCount; ++i)
+	{
+		const SubmeshGeometry& submesh = geometry->submeshes[i];
+		if (submesh.indexCount == 0)
+			continue;
 		auto renderItem = std::make_unique<RenderItem>();
-		renderItem->objCBIndex = objCBIndex;
+		auto meshTransform = meshTransforms.find(submesh.meshName);
+		if (meshTransform == meshTransforms.end())
+			meshTransform = meshTransforms.emplace(submesh.meshName, mTransforms.Add(entityTransform)).first;
+		renderItem->transform = meshTransform->second;
 		renderItem->geo = geometry;
+		renderItem->geoSortId = mGeometrySortIds.emplace(geometry, (UINT)mGeometrySortIds.size()).first->second;
 		renderItem->primitiveType = topology;
-		renderItem->indexCount = renderItem->geo->drawArgs[subMeshName].indexCount;
-		renderItem->startIndexLocation = renderItem->geo->drawArgs[subMeshName].startIndexLocation;
-		renderItem->baseVertexLocation = renderItem->geo->drawArgs[subMeshName].baseVertexLocation;
-		renderItem->materialName = e.mtlName;
-		renderItem->id = meshData.name;
+		renderItem->indexCount = submesh.indexCount;
+		renderItem->startIndexLocation = submesh.startIndexLocation;
+		renderItem->baseVertexLocation = submesh.baseVertexLocation;
+		renderItem->firstMeshlet = submesh.firstMeshlet;
+		renderItem->meshletCount = submesh.meshletCount;
+		renderItem->lodLevel = submesh.lodLevel;
+		renderItem->lodCount = submesh.lodCount;
+		renderItem->materialName = submesh.materialName;
+		renderItem->id = submesh.meshName;
+		renderItem->localAabb = submesh.aabb;
+		renderItem->localSphere = submesh.sphere;
+		UpdateWorldBounds(renderItem.get(), mTransforms.World(renderItem->transform));
 
 		riList.push_back(std::move(renderItem));
+	}
+}
+void D3DToy::PackVertices(MeshGeometry* geometry, const std::vector<GeometryGenerator::Vertex>& vertices, std::vector<SceneVertex>& packed)
+{
+	VertexFormat::PositionTransform transform = SceneVertexLayout::ComputeTransform(vertices);
+	SceneVertexLayout::Pack(vertices, transform, packed);
+	geometry->positionScale = transform.scale;
+	geometry->positionBias = transform.bias;
+
+	//Bounding sphere around the box center, used for LOD selection
+	if (vertices.empty())
+		return;
+	XMVECTOR minimum = XMLoadFloat3(&vertices[0].position);
+	XMVECTOR maximum = minimum;
+	for (auto& v : vertices)
+	{
+		minimum = XMVectorMin(minimum, XMLoadFloat3(&v.position));
+		maximum = XMVectorMax(maximum, XMLoadFloat3(&v.position));
+	}
+	XMVECTOR center = XMVectorScale(XMVectorAdd(minimum, maximum), 0.5f);
+	float radius = 0.0f;
+	for (auto& v : vertices)
+	{
+		radius = (std::fmax)(radius, XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&v.position), center))));
+	}
+	XMStoreFloat3(&geometry->boundsCenter, center);
+	geometry->boundsRadius = radius;
+}
+void D3DToy::ExtractOccluder(MeshGeometry* geometry, const SceneVertex* vertices, const SceneIndex* indices, size_t firstSubmesh, size_t submeshCount)
+{
+	VertexFormat::PositionTransform transform;
+	transform.scale = geometry->positionScale;
+	transform.bias = geometry->positionBias;
+	//Buffer vertex -> occluder vertex
+	std::unordered_map<UINT, uint32_t> remap;
+	for (size_t i = firstSubmesh; i < firstSubmesh + submeshCount; ++i)
+	{
+		const SubmeshGeometry& submesh = geometry->submeshes[i];
+		if (submesh.lodLevel + 1 != submesh.lodCount)
+			continue;
+		for (UINT k = 0; k < submesh.indexCount; ++k)
+		{
+			UINT vertex = submesh.baseVertexLocation + indices[submesh.startIndexLocation + k];
+			auto found = remap.find(vertex);
+			if (found == remap.end())
+			{
+				found = remap.emplace(vertex, static_cast<uint32_t>(geometry->occluderPositions.size())).first;
+				geometry->occluderPositions.push_back(SceneVertexLayout::UnpackPosition(vertices[vertex], transform));
+			}
+			geometry->occluderIndices.push_back(found->second);
+		}
+	}
+}
+void D3DToy::UpdateWorldBounds(RenderItem* ri, FXMMATRIX world)
+{
+	ri->localAabb.Transform(ri->worldAabb, world);
+	ri->localSphere.Transform(ri->worldSphere, world);
+	if (ri->bvhProxy != DynamicBVH::kNull)
+		mSceneBVH.MoveProxy(ri->bvhProxy, ri->worldAabb);
+}
+void D3DToy::UploadGeometry(MeshGeometry* geometry, const void* vertexData, UINT vertexCount, const void* indexData, UINT indexCount)
+{
+	const UINT vbByteSize = vertexCount * sizeof(SceneVertex);
+	const UINT ibByteSize = indexCount * sizeof(SceneIndex);
+
+	//Set necessary info
+	geometry->vertexBufferByteSize = vbByteSize;
+	geometry->vertexByteStride = sizeof(SceneVertex);
+	geometry->indexFormat = DXGI_FORMAT_R16_UINT;
+	geometry->indexBufferByteSize = ibByteSize;
+	if (vbByteSize == 0 || ibByteSize == 0)
+		return;
+
+	//Committed to default heap intermediately. IASetVertex/IndexBuffer indicates the interpting ways
+	CreateDefaultBuffer(mDevice.Get(), mCommandList.Get(), vertexData, vbByteSize, geometry->vertexBufferGPU, geometry->vertexBufferUploader);
+	CreateDefaultBuffer(mDevice.Get(), mCommandList.Get(), indexData, ibByteSize, geometry->indexBufferGPU, geometry->indexBufferUploader);
+}
+MeshGeometry* D3DToy::LoadObjGeometry(const std::string& path, const std::string& fileName, std::vector<MaterialLoader::Material>& mtlList)
+{
+	auto geometry = std::make_unique<MeshGeometry>();
+	geometry->Name = fileName;
+
+	std::vector<std::string> mtlLibs;
+	uint64_t sourceHash = MeshCache::HashSource(path, fileName, mtlLibs);
+	std::string cacheFile = path + "\\" + fileName + ".meshcache";
+
+	MappedFile cache;
+	MeshCache::View view;
+	if (MeshCache::Load(cacheFile, sourceHash, cache, view) && view.vertexFormat == SceneVertexLayout::kId &&
+		view.vertexStride == sizeof(SceneVertex) && view.indexStride == sizeof(SceneIndex))
+	{
+		//Cache hit: no OBJ parsing, the mapped ranges are uploaded as they are
+		MaterialLoader mtlLoader;
+		for (auto& lib : mtlLibs)
+		{
+			mtlLoader.ReadMtlFile(path, lib, mtlList);
+		}
+		for (auto& submesh : view.submeshes)
+		{
+			if (submesh.lodLevel == 0)
+				geometry->drawArgs[submesh.meshName + "_" + submesh.materialName] = submesh;
+		}
+		geometry->submeshes = std::move(view.submeshes);
+		geometry->meshlets = std::move(view.meshlets);
+		geometry->positionScale = view.positionScale;
+		geometry->positionBias = view.positionBias;
+		geometry->boundsCenter = view.boundsCenter;
+		geometry->boundsRadius = view.boundsRadius;
+		geometry->lodErrors = std::move(view.lodErrors);
+		UploadGeometry(geometry.get(), view.vertexData, view.vertexCount, view.indexData, view.indexCount);
+		ExtractOccluder(geometry.get(), static_cast<const SceneVertex*>(view.vertexData), static_cast<const SceneIndex*>(view.indexData),
+			0, geometry->submeshes.size());
+	}
+	else
+	{
+		cache.Close();
+		GeometryGenerator geoGen;
+		std::vector<GeometryGenerator::MeshData> objMeshes;
+		geoGen.ReadObjFile(path, fileName, objMeshes, mtlList, &mJobs);
+		//Meshes are cooked independently, one job each
+		mJobs.ParallelFor(objMeshes.size(), 1, [&](size_t begin, size_t end)
+		{
+			for (size_t i = begin; i < end; ++i)
+			{
+				//Cooked once, so the slower overdraw ordering is affordable
+				MeshOptimizer::Optimize(objMeshes[i], true);
+				MeshSimplifier::GenerateLods(objMeshes[i], MeshSimplifier::kMaxLodLevels);
+			}
+		});
+		for (auto& mesh : objMeshes)
+		{
+			//Conservative error per level over all meshes
+			if (geometry->lodErrors.size() < mesh.lods.size() + 1)
+				geometry->lodErrors.resize(mesh.lods.size() + 1, 0.0f);
+			for (size_t level = 0; level < mesh.lods.size(); ++level)
+			{
+				geometry->lodErrors[level + 1] = (std::fmax)(geometry->lodErrors[level + 1], mesh.lods[level].error);
+			}
+		}
 
-		indexOffset += (UINT)submesh.indexCount;
+		std::vector<GeometryGenerator::Vertex> vertices;
+		std::vector<SceneIndex> indices;
+		UINT indexOffset = 0, vertexOffset = 0;
+		for (auto& mesh : objMeshes)
+		{
+			BuildSingleGeometry(mesh, geometry.get(), vertices, vertexOffset, indices, indexOffset);
+		}
+		std::vector<SceneVertex> packed;
+		PackVertices(geometry.get(), vertices, packed);
+		UploadGeometry(geometry.get(), packed.data(), packed.size(), indices.data(), indices.size());
+		ExtractOccluder(geometry.get(), packed.data(), indices.data(), 0, geometry->submeshes.size());
+
+		MeshCache::View cooked;
+		cooked.vertexFormat = SceneVertexLayout::kId;
+		cooked.positionScale = geometry->positionScale;
+		cooked.positionBias = geometry->positionBias;
+		cooked.boundsCenter = geometry->boundsCenter;
+		cooked.boundsRadius = geometry->boundsRadius;
+		cooked.lodErrors = geometry->lodErrors;
+		cooked.vertexData = packed.data();
+		cooked.vertexCount = packed.size();
+		cooked.vertexStride = sizeof(SceneVertex);
+		cooked.indexData = indices.data();
+		cooked.indexCount = indices.size();
+		cooked.indexStride = sizeof(SceneIndex);
+		cooked.submeshes = geometry->submeshes;
+		cooked.meshlets = geometry->meshlets;
+		if (!MeshCache::Save(cacheFile, sourceHash, cooked))
+		{
+			OutputDebugStringA(("Failed to write mesh cache " + cacheFile + "\n").c_str());
+		}
 	}
-	vertexOffset += (UINT)meshData.vertices.size();
-}
\ No newline at end of file
+	MeshGeometry* result = geometry.get();
+	mGeometries[fileName] = std::move(geometry);
+	return result;
+}
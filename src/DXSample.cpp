@@ -18,7 +18,13 @@ DXSample::DXSample(UINT width, UINT height, std::wstring name) :
     mWidth(width),
     mHeight(height),
     m_title(name),
-    m_useWarpDevice(false)
+    m_useWarpDevice(false),
+    m_cullBenchmark(false),
+    m_pacerSelfTest(false),
+    m_framesInFlight(3),
+    m_targetFps(0.0f),
+    m_benchmark(false),
+    m_benchmarkSeconds(0.0f)
 {
     mTimer = GameTimer();
 }
@@ -114,11 +120,36 @@ void DXSample::ParseCommandLineArgs(WCHAR* argv[], int argc)
             m_useWarpDevice = true;
             m_title = m_title + L" (WARP)";
         }
+        else if (_wcsnicmp(argv[i], L"-cullbench", wcslen(argv[i])) == 0 ||
+            _wcsnicmp(argv[i], L"/cullbench", wcslen(argv[i])) == 0)
+        {
+            m_cullBenchmark = true;
+        }
+        else if (_wcsicmp(argv[i], L"-pacertest") == 0 || _wcsicmp(argv[i], L"/pacertest") == 0)
+        {
+            m_pacerSelfTest = true;
+        }
+        else if ((_wcsicmp(argv[i], L"-frames") == 0 || _wcsicmp(argv[i], L"/frames") == 0) && i + 1 < argc)
+        {
+            m_framesInFlight = static_cast<UINT>(_wtoi(argv[++i]));
+        }
+        else if ((_wcsicmp(argv[i], L"-fps") == 0 || _wcsicmp(argv[i], L"/fps") == 0) && i + 1 < argc)
+        {
+            m_targetFps = static_cast<float>(_wtof(argv[++i]));
+        }
+        else if (_wcsicmp(argv[i], L"-benchmark") == 0 || _wcsicmp(argv[i], L"/benchmark") == 0)
+        {
+            m_benchmark = true;
+            // Optional duration
+            if (i + 1 < argc && iswdigit(argv[i + 1][0]))
+                m_benchmarkSeconds = static_cast<float>(_wtof(argv[++i]));
+        }
     }
 }
 void DXSample::OnInit()
 {
     mTimer.OnReset();
+    mFrameLimiter.SetTargetFps(m_benchmark ? 0.0f : m_targetFps);
 }
 void DXSample::OnUpdate()
 {
@@ -1,6 +1,18 @@
-cbuffer cbPerObject : register(b0)
+//Matches ObjectConstants on the CPU side
+struct InstanceData
 {
     float4x4 world;
+    //Vertex decode, matches SceneVertexLayout on the CPU side
+    float3 positionScale;
+    uint octNormal;
+    float3 positionBias;
+    float pad;
+};
+StructuredBuffer<InstanceData> gInstances : register(t1);
+//First instance of the draw in gInstances
+cbuffer cbInstance : register(b0)
+{
+    uint instanceBase;
 }
 cbuffer cbPassObject : register(b2)
 {
@@ -20,9 +32,26 @@ cbuffer cbPassObject : register(b2)
     float totalTime;
 }
 
-void VS(float3 posL : POSITION, float3 normalL : NORMAL,
+//Octahedral normal, xy in [-1, 1]
+float3 OctDecode(float2 e)
+{
+    float3 n = float3(e.xy, 1.0f - abs(e.x) - abs(e.y));
+    float t = saturate(-n.z);
+    n.xy += n.xy >= 0.0f ? -t : t;
+    return normalize(n);
+}
+
+void VS(float3 posL : POSITION, float3 normalL : NORMAL, uint instanceID : SV_InstanceID,
     out float4 posH : SV_POSITION, out float4 posW : POSITION, out float3 normalW : NORMAL, inout float2 texC : TEXC)//Sequence order matters
 {
+    InstanceData instance = gInstances[instanceBase + instanceID];
+    float4x4 world = instance.world;
+    float3 positionScale = instance.positionScale;
+    float3 positionBias = instance.positionBias;
+    uint octNormal = instance.octNormal;
+    //Quantized positions are normalized inside the mesh bounds. Identity scale/bias for float positions.
+    posL = posL * positionScale + positionBias;
+    normalL = octNormal ? OctDecode(normalL.xy) : normalL;
     //Transform to world space
     posW = mul(float4(posL, 1.0f), world);
     //Transform to homogeneous clip space
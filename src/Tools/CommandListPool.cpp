@@ -0,0 +1,75 @@
+#include "Tools/CommandListPool.h"
+#include <algorithm>
+
+CommandListPool::CommandListPool(ID3D12Device* device, UINT frameCount, UINT threadCount,
+	D3D12_COMMAND_LIST_TYPE type) :
+	mDevice(device),
+	mType(type),
+	mFrames(frameCount)
+{
+	for (auto& frame : mFrames)
+	{
+		frame.threads.resize(threadCount);
+		for (auto& slot : frame.threads)
+		{
+			ThrowIfFailed(mDevice->CreateCommandAllocator(mType, IID_PPV_ARGS(&slot.allocator)));
+		}
+	}
+}
+void CommandListPool::BeginFrame(UINT frameIndex)
+{
+	Frame& frame = mFrames[frameIndex];
+	UINT listsThisFrame = 0;
+	for (auto& slot : frame.threads)
+	{
+		listsThisFrame += slot.used;
+		//Allocators nothing was recorded into are still empty
+		if (slot.used == 0)
+			continue;
+		ThrowIfFailed(slot.allocator->Reset());
+		slot.used = 0;
+	}
+	mPeakListsPerFrame = (std::max)(mPeakListsPerFrame, listsThisFrame);
+	mCurrentFrame = frameIndex;
+}
+ID3D12GraphicsCommandList* CommandListPool::Acquire(UINT thread, ID3D12PipelineState* initialState)
+{
+	ThreadSlot& slot = mFrames[mCurrentFrame].threads[thread];
+	if (slot.used == slot.lists.size())
+	{
+		//Created closed, never bound to an allocator another list may be recording on
+		ComPtr<ID3D12GraphicsCommandList> list;
+		ComPtr<ID3D12Device4> device4;
+		if (SUCCEEDED(mDevice->QueryInterface(IID_PPV_ARGS(&device4))))
+		{
+			ThrowIfFailed(device4->CreateCommandList1(0, mType, D3D12_COMMAND_LIST_FLAG_NONE, IID_PPV_ARGS(&list)));
+		}
+		else
+		{
+			//Older runtimes, the thread's own allocator has no list recording when it asks for a new one
+			ThrowIfFailed(mDevice->CreateCommandList(0, mType, slot.allocator.Get(), nullptr, IID_PPV_ARGS(&list)));
+			ThrowIfFailed(list->Close());
+		}
+		slot.lists.push_back(list);
+	}
+	ThrowIfFailed(slot.lists[slot.used]->Reset(slot.allocator.Get(), initialState));
+	ID3D12GraphicsCommandList* list = slot.lists[slot.used].Get();
+	++slot.used;
+	slot.peakUsed = (std::max)(slot.peakUsed, slot.used);
+	return list;
+}
+CommandListPool::Stats CommandListPool::GetStats() const
+{
+	Stats stats;
+	stats.peakListsPerFrame = mPeakListsPerFrame;
+	for (auto& frame : mFrames)
+	{
+		for (auto& slot : frame.threads)
+		{
+			++stats.allocatorCount;
+			stats.listCount += static_cast<UINT>(slot.lists.size());
+			stats.peakListsPerAllocator = (std::max)(stats.peakListsPerAllocator, slot.peakUsed);
+		}
+	}
+	return stats;
+}
@@ -0,0 +1,73 @@
+#include "Tools/DrawSortKey.h"
+
+namespace
+{
+	UINT64 Field(UINT value, UINT bits, UINT shift)
+	{
+		return (static_cast<UINT64>(value) & ((1ull << bits) - 1)) << shift;
+	}
+}
+
+UINT64 DrawSortKey::Pack(UINT pso, UINT rootSignature, UINT material, UINT texture, UINT geometry, float depth)
+{
+	const UINT depthMax = (1u << kDepthBits) - 1;
+	float clamped = depth < 0.0f ? 0.0f : (depth > 1.0f ? 1.0f : depth);
+	//A float cannot hold every step of the depth field
+	UINT quantized = static_cast<UINT>(static_cast<double>(clamped) * depthMax + 0.5);
+
+	UINT shift = 0;
+	UINT64 key = Field(quantized, kDepthBits, shift);
+	shift += kDepthBits;
+	key |= Field(geometry, kGeometryBits, shift);
+	shift += kGeometryBits;
+	key |= Field(texture, kTextureBits, shift);
+	shift += kTextureBits;
+	key |= Field(material, kMaterialBits, shift);
+	shift += kMaterialBits;
+	key |= Field(rootSignature, kRootSignatureBits, shift);
+	shift += kRootSignatureBits;
+	key |= Field(pso, kPsoBits, shift);
+	return key;
+}
+void DrawSortKey::RadixSort(std::vector<Entry>& entries, std::vector<Entry>& scratch)
+{
+	const size_t count = entries.size();
+	if (count < 2)
+		return;
+	scratch.resize(count);
+
+	//All eight histograms in one read of the keys
+	size_t histograms[8][256] = {};
+	for (const Entry& entry : entries)
+	{
+		for (UINT pass = 0; pass < 8; ++pass)
+		{
+			++histograms[pass][(entry.key >> (pass * 8)) & 0xFF];
+		}
+	}
+
+	Entry* source = entries.data();
+	Entry* destination = scratch.data();
+	for (UINT pass = 0; pass < 8; ++pass)
+	{
+		size_t* histogram = histograms[pass];
+		//Every key has the same digit, the pass would not move anything
+		if (histogram[(source[0].key >> (pass * 8)) & 0xFF] == count)
+			continue;
+		size_t offset = 0;
+		for (UINT digit = 0; digit < 256; ++digit)
+		{
+			size_t bucket = histogram[digit];
+			histogram[digit] = offset;
+			offset += bucket;
+		}
+		for (size_t i = 0; i < count; ++i)
+		{
+			const Entry& entry = source[i];
+			destination[histogram[(entry.key >> (pass * 8)) & 0xFF]++] = entry;
+		}
+		std::swap(source, destination);
+	}
+	if (source != entries.data())
+		entries.swap(scratch);
+}
@@ -0,0 +1,523 @@
+#include "Tools/DynamicBVH.h"
+#include <algorithm>
+
+using namespace DirectX;
+
+namespace
+{
+	void Union(const XMFLOAT3& minA, const XMFLOAT3& maxA, const XMFLOAT3& minB, const XMFLOAT3& maxB, XMFLOAT3& minimum, XMFLOAT3& maximum)
+	{
+		XMStoreFloat3(&minimum, XMVectorMin(XMLoadFloat3(&minA), XMLoadFloat3(&minB)));
+		XMStoreFloat3(&maximum, XMVectorMax(XMLoadFloat3(&maxA), XMLoadFloat3(&maxB)));
+	}
+	float SurfaceArea(const XMFLOAT3& minimum, const XMFLOAT3& maximum)
+	{
+		float x = maximum.x - minimum.x, y = maximum.y - minimum.y, z = maximum.z - minimum.z;
+		return 2.0f * (x * y + y * z + z * x);
+	}
+	float Component(const XMFLOAT3& v, int axis)
+	{
+		return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+	}
+}
+
+BoundingBox DynamicBVH::Node::Box() const
+{
+	BoundingBox box;
+	XMVECTOR minV = XMLoadFloat3(&minimum), maxV = XMLoadFloat3(&maximum);
+	XMStoreFloat3(&box.Center, XMVectorScale(XMVectorAdd(minV, maxV), 0.5f));
+	XMStoreFloat3(&box.Extents, XMVectorScale(XMVectorSubtract(maxV, minV), 0.5f));
+	return box;
+}
+DynamicBVH::~DynamicBVH()
+{
+	//The job reads nothing of ours, but it writes its result into the tree
+	if (mRebuilding)
+		mJobs.Wait(mRebuildCounter);
+}
+int DynamicBVH::CreateProxy(const BoundingBox& aabb, void* userData)
+{
+	int proxy;
+	if (!mFreeProxies.empty())
+	{
+		proxy = mFreeProxies.back();
+		mFreeProxies.pop_back();
+	}
+	else
+	{
+		proxy = static_cast<int>(mProxies.size());
+		mProxies.emplace_back();
+	}
+	int leaf = AllocateNode();
+	mNodes[leaf].proxy = proxy;
+	SetFatBox(mNodes[leaf], aabb);
+	InsertLeaf(leaf);
+
+	Proxy& entry = mProxies[proxy];
+	entry.aabb = aabb;
+	entry.userData = userData;
+	entry.node = leaf;
+	entry.alive = true;
+	MarkChanged(proxy);
+	++mProxyCount;
+	return proxy;
+}
+void DynamicBVH::DestroyProxy(int proxy)
+{
+	Proxy& entry = mProxies[proxy];
+	RemoveLeaf(entry.node);
+	FreeNode(entry.node);
+	entry.node = kNull;
+	entry.alive = false;
+	entry.userData = nullptr;
+	MarkChanged(proxy);
+	mFreeProxies.push_back(proxy);
+	--mProxyCount;
+}
+bool DynamicBVH::MoveProxy(int proxy, const BoundingBox& aabb)
+{
+	Proxy& entry = mProxies[proxy];
+	entry.aabb = aabb;
+	MarkChanged(proxy);
+
+	int leaf = entry.node;
+	Node& node = mNodes[leaf];
+	XMVECTOR minV = XMVectorSubtract(XMLoadFloat3(&aabb.Center), XMLoadFloat3(&aabb.Extents));
+	XMVECTOR maxV = XMVectorAdd(XMLoadFloat3(&aabb.Center), XMLoadFloat3(&aabb.Extents));
+	XMVECTOR fatMin = XMLoadFloat3(&node.minimum), fatMax = XMLoadFloat3(&node.maximum);
+	if (XMVector3GreaterOrEqual(minV, fatMin) && XMVector3LessOrEqual(maxV, fatMax))
+		return false;
+
+	//Still overlapping the old fat box: grow the leaf in place and refit the ancestors.
+	//A jump elsewhere is reinserted, refitting would stretch the whole path to the root.
+	bool overlaps = XMVector3LessOrEqual(minV, fatMax) && XMVector3GreaterOrEqual(maxV, fatMin);
+	if (overlaps)
+	{
+		SetFatBox(node, aabb);
+		Refit(node.parent);
+	}
+	else
+	{
+		RemoveLeaf(leaf);
+		SetFatBox(mNodes[leaf], aabb);
+		InsertLeaf(leaf);
+	}
+	return true;
+}
+void DynamicBVH::SetFatBox(Node& node, const BoundingBox& aabb) const
+{
+	XMVECTOR center = XMLoadFloat3(&aabb.Center);
+	XMVECTOR extents = XMLoadFloat3(&aabb.Extents);
+	extents = XMVectorAdd(XMVectorScale(extents, 1.0f + kFatScale), XMVectorReplicate(kFatMargin));
+	XMStoreFloat3(&node.minimum, XMVectorSubtract(center, extents));
+	XMStoreFloat3(&node.maximum, XMVectorAdd(center, extents));
+}
+void DynamicBVH::MarkChanged(int proxy)
+{
+	if (!mRebuilding || mProxies[proxy].changed)
+		return;
+	mProxies[proxy].changed = true;
+	mChangedProxies.push_back(proxy);
+}
+int DynamicBVH::AllocateNode()
+{
+	int node;
+	if (mFreeNode != kNull)
+	{
+		node = mFreeNode;
+		mFreeNode = mNodes[node].parent;
+		mNodes[node] = Node();
+	}
+	else
+	{
+		node = static_cast<int>(mNodes.size());
+		mNodes.emplace_back();
+	}
+	return node;
+}
+void DynamicBVH::FreeNode(int node)
+{
+	mNodes[node].parent = mFreeNode;
+	mNodes[node].height = -1;
+	mFreeNode = node;
+}
+void DynamicBVH::InsertLeaf(int leaf)
+{
+	if (mRoot == kNull)
+	{
+		mRoot = leaf;
+		mNodes[leaf].parent = kNull;
+		return;
+	}
+
+	//Descend towards the sibling with the lowest cost: the new parent's area plus the growth of every ancestor
+	const XMFLOAT3 leafMin = mNodes[leaf].minimum, leafMax = mNodes[leaf].maximum;
+	int index = mRoot;
+	while (!mNodes[index].IsLeaf())
+	{
+		const Node& node = mNodes[index];
+		XMFLOAT3 minimum, maximum;
+		Union(node.minimum, node.maximum, leafMin, leafMax, minimum, maximum);
+		float area = SurfaceArea(node.minimum, node.maximum);
+		float combinedArea = SurfaceArea(minimum, maximum);
+		float cost = 2.0f * combinedArea;
+		float inheritanceCost = 2.0f * (combinedArea - area);
+
+		float childCost[2];
+		int children[2] = { node.child1, node.child2 };
+		for (int i = 0; i < 2; ++i)
+		{
+			const Node& child = mNodes[children[i]];
+			Union(child.minimum, child.maximum, leafMin, leafMax, minimum, maximum);
+			childCost[i] = SurfaceArea(minimum, maximum) + inheritanceCost;
+			if (!child.IsLeaf())
+				childCost[i] -= SurfaceArea(child.minimum, child.maximum);
+		}
+		if (cost < childCost[0] && cost < childCost[1])
+			break;
+		index = childCost[0] < childCost[1] ? children[0] : children[1];
+	}
+
+	int sibling = index;
+	int oldParent = mNodes[sibling].parent;
+	int newParent = AllocateNode();
+	mNodes[newParent].parent = oldParent;
+	Union(leafMin, leafMax, mNodes[sibling].minimum, mNodes[sibling].maximum, mNodes[newParent].minimum, mNodes[newParent].maximum);
+	mNodes[newParent].height = mNodes[sibling].height + 1;
+	mNodes[newParent].child1 = sibling;
+	mNodes[newParent].child2 = leaf;
+	mNodes[sibling].parent = newParent;
+	mNodes[leaf].parent = newParent;
+	if (oldParent == kNull)
+	{
+		mRoot = newParent;
+	}
+	else if (mNodes[oldParent].child1 == sibling)
+	{
+		mNodes[oldParent].child1 = newParent;
+	}
+	else
+	{
+		mNodes[oldParent].child2 = newParent;
+	}
+	Refit(newParent);
+}
+void DynamicBVH::RemoveLeaf(int leaf)
+{
+	if (leaf == mRoot)
+	{
+		mRoot = kNull;
+		return;
+	}
+	int parent = mNodes[leaf].parent;
+	int grandParent = mNodes[parent].parent;
+	int sibling = mNodes[parent].child1 == leaf ? mNodes[parent].child2 : mNodes[parent].child1;
+	FreeNode(parent);
+	if (grandParent == kNull)
+	{
+		mRoot = sibling;
+		mNodes[sibling].parent = kNull;
+		return;
+	}
+	if (mNodes[grandParent].child1 == parent)
+		mNodes[grandParent].child1 = sibling;
+	else
+		mNodes[grandParent].child2 = sibling;
+	mNodes[sibling].parent = grandParent;
+	Refit(grandParent);
+}
+void DynamicBVH::Refit(int index)
+{
+	//Rebalance on the way up, boxes and heights follow the new children
+	while (index != kNull)
+	{
+		index = Balance(index);
+		Node& node = mNodes[index];
+		const Node& child1 = mNodes[node.child1];
+		const Node& child2 = mNodes[node.child2];
+		node.height = 1 + (std::max)(child1.height, child2.height);
+		Union(child1.minimum, child1.maximum, child2.minimum, child2.maximum, node.minimum, node.maximum);
+		index = node.parent;
+	}
+}
+int DynamicBVH::Balance(int a)
+{
+	if (mNodes[a].IsLeaf() || mNodes[a].height < 2)
+		return a;
+	int b = mNodes[a].child1;
+	int c = mNodes[a].child2;
+	int balance = mNodes[c].height - mNodes[b].height;
+	if (balance >= -1 && balance <= 1)
+		return a;
+
+	//Rotate the taller child up, it takes a's place and a keeps the shorter grandchild
+	int up = balance > 1 ? c : b;
+	int other = balance > 1 ? b : c;
+	int f = mNodes[up].child1;
+	int g = mNodes[up].child2;
+	mNodes[up].child1 = a;
+	mNodes[up].parent = mNodes[a].parent;
+	mNodes[a].parent = up;
+	int upParent = mNodes[up].parent;
+	if (upParent == kNull)
+		mRoot = up;
+	else if (mNodes[upParent].child1 == a)
+		mNodes[upParent].child1 = up;
+	else
+		mNodes[upParent].child2 = up;
+
+	int keep = mNodes[f].height > mNodes[g].height ? f : g;
+	int give = keep == f ? g : f;
+	mNodes[up].child2 = keep;
+	if (balance > 1)
+		mNodes[a].child2 = give;
+	else
+		mNodes[a].child1 = give;
+	mNodes[give].parent = a;
+
+	Node& nodeA = mNodes[a];
+	Union(mNodes[other].minimum, mNodes[other].maximum, mNodes[give].minimum, mNodes[give].maximum, nodeA.minimum, nodeA.maximum);
+	nodeA.height = 1 + (std::max)(mNodes[other].height, mNodes[give].height);
+	Node& nodeUp = mNodes[up];
+	Union(nodeA.minimum, nodeA.maximum, mNodes[keep].minimum, mNodes[keep].maximum, nodeUp.minimum, nodeUp.maximum);
+	nodeUp.height = 1 + (std::max)(nodeA.height, mNodes[keep].height);
+	return up;
+}
+float DynamicBVH::ComputeCost() const
+{
+	float cost = 0.0f;
+	for (auto& node : mNodes)
+	{
+		if (node.height > 0)
+			cost += SurfaceArea(node.minimum, node.maximum);
+	}
+	return cost;
+}
+void DynamicBVH::Update()
+{
+	if (mRebuilding)
+	{
+		if (mRebuildCounter.Done())
+		{
+			mRebuilding = false;
+			SwapRebuild(mRebuildResult);
+		}
+		return;
+	}
+	if (++mUpdatesSinceCheck < kQualityCheckInterval)
+		return;
+	mUpdatesSinceCheck = 0;
+	if (mProxyCount < 2)
+		return;
+	//Incremental insertion alone never had a full build to compare with
+	if (mBuildCost <= 0.0f || ComputeCost() > kRebuildRatio * mBuildCost)
+		StartRebuild();
+}
+void DynamicBVH::FinishRebuild()
+{
+	if (!mRebuilding)
+		return;
+	mJobs.Wait(mRebuildCounter);
+	mRebuilding = false;
+	SwapRebuild(mRebuildResult);
+}
+void DynamicBVH::StartRebuild()
+{
+	//The job only sees this snapshot, later changes are replayed by SwapRebuild()
+	std::vector<BuildInput> inputs;
+	inputs.reserve(mProxyCount);
+	for (size_t i = 0; i < mProxies.size(); ++i)
+	{
+		if (!mProxies[i].alive)
+			continue;
+		const Node& leaf = mNodes[mProxies[i].node];
+		inputs.push_back({ leaf.minimum, leaf.maximum, static_cast<int>(i) });
+	}
+	mChangedProxies.clear();
+	mRebuilding = true;
+	mJobs.Run([this, inputs = std::move(inputs)]() mutable
+	{
+		mRebuildResult = BuildSAH(std::move(inputs));
+	}, &mRebuildCounter);
+}
+void DynamicBVH::SwapRebuild(BuildResult& result)
+{
+	mNodes = std::move(result.nodes);
+	mRoot = result.root;
+	mFreeNode = kNull;
+	for (auto& proxy : mProxies)
+	{
+		proxy.node = kNull;
+	}
+	for (size_t i = 0; i < mNodes.size(); ++i)
+	{
+		if (mNodes[i].IsLeaf())
+			mProxies[mNodes[i].proxy].node = static_cast<int>(i);
+	}
+
+	//Replay what happened while the worker was busy
+	for (int proxy : mChangedProxies)
+	{
+		Proxy& entry = mProxies[proxy];
+		entry.changed = false;
+		if (!entry.alive)
+		{
+			if (entry.node != kNull)
+			{
+				RemoveLeaf(entry.node);
+				FreeNode(entry.node);
+				entry.node = kNull;
+			}
+			continue;
+		}
+		if (entry.node == kNull)
+		{
+			entry.node = AllocateNode();
+			mNodes[entry.node].proxy = proxy;
+		}
+		else
+		{
+			RemoveLeaf(entry.node);
+		}
+		SetFatBox(mNodes[entry.node], entry.aabb);
+		InsertLeaf(entry.node);
+	}
+	mChangedProxies.clear();
+	mBuildCost = ComputeCost();
+}
+DynamicBVH::BuildResult DynamicBVH::BuildSAH(std::vector<BuildInput> inputs)
+{
+	BuildResult result;
+	if (inputs.empty())
+		return result;
+	const int kBins = 12;
+	result.nodes.reserve(inputs.size() * 2 - 1);
+
+	struct Task
+	{
+		size_t begin;
+		size_t end;
+		int parent;
+	};
+	std::vector<Task> tasks;
+	tasks.push_back({ 0, inputs.size(), kNull });
+	while (!tasks.empty())
+	{
+		Task task = tasks.back();
+		tasks.pop_back();
+		int index = static_cast<int>(result.nodes.size());
+		result.nodes.emplace_back();
+		result.nodes[index].parent = task.parent;
+		if (task.parent == kNull)
+			result.root = index;
+		else if (result.nodes[task.parent].child1 == kNull)
+			result.nodes[task.parent].child1 = index;
+		else
+			result.nodes[task.parent].child2 = index;
+
+		if (task.end - task.begin == 1)
+		{
+			Node& leaf = result.nodes[index];
+			leaf.minimum = inputs[task.begin].minimum;
+			leaf.maximum = inputs[task.begin].maximum;
+			leaf.proxy = inputs[task.begin].proxy;
+			continue;
+		}
+
+		//Bin the centroids along the widest axis of their bounds
+		XMFLOAT3 centroidMin(FLT_MAX, FLT_MAX, FLT_MAX), centroidMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for (size_t i = task.begin; i < task.end; ++i)
+		{
+			XMFLOAT3 centroid;
+			XMStoreFloat3(&centroid, XMVectorScale(XMVectorAdd(XMLoadFloat3(&inputs[i].minimum), XMLoadFloat3(&inputs[i].maximum)), 0.5f));
+			Union(centroidMin, centroidMax, centroid, centroid, centroidMin, centroidMax);
+		}
+		int axis = 0;
+		float extent = centroidMax.x - centroidMin.x;
+		if (centroidMax.y - centroidMin.y > extent)
+		{
+			axis = 1;
+			extent = centroidMax.y - centroidMin.y;
+		}
+		if (centroidMax.z - centroidMin.z > extent)
+		{
+			axis = 2;
+			extent = centroidMax.z - centroidMin.z;
+		}
+
+		size_t middle = task.begin + (task.end - task.begin) / 2;
+		if (extent > 0.0f)
+		{
+			float axisMin = Component(centroidMin, axis);
+			float binScale = kBins / extent;
+			auto binOf = [&](const BuildInput& input)
+			{
+				float centroid = 0.5f * (Component(input.minimum, axis) + Component(input.maximum, axis));
+				int bin = static_cast<int>((centroid - axisMin) * binScale);
+				return bin < kBins - 1 ? bin : kBins - 1;
+			};
+			struct Bin
+			{
+				XMFLOAT3 minimum = XMFLOAT3(FLT_MAX, FLT_MAX, FLT_MAX);
+				XMFLOAT3 maximum = XMFLOAT3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+				size_t count = 0;
+			};
+			Bin bins[kBins];
+			for (size_t i = task.begin; i < task.end; ++i)
+			{
+				Bin& bin = bins[binOf(inputs[i])];
+				Union(bin.minimum, bin.maximum, inputs[i].minimum, inputs[i].maximum, bin.minimum, bin.maximum);
+				++bin.count;
+			}
+			//Sweep from the right for the right side costs, then from the left
+			float rightCost[kBins];
+			Bin right;
+			for (int i = kBins - 1; i > 0; --i)
+			{
+				Union(right.minimum, right.maximum, bins[i].minimum, bins[i].maximum, right.minimum, right.maximum);
+				right.count += bins[i].count;
+				rightCost[i] = right.count > 0 ? right.count * SurfaceArea(right.minimum, right.maximum) : 0.0f;
+			}
+			Bin left;
+			float bestCost = FLT_MAX;
+			int bestSplit = -1;
+			for (int i = 0; i < kBins - 1; ++i)
+			{
+				Union(left.minimum, left.maximum, bins[i].minimum, bins[i].maximum, left.minimum, left.maximum);
+				left.count += bins[i].count;
+				if (left.count == 0 || left.count == task.end - task.begin)
+					continue;
+				float cost = left.count * SurfaceArea(left.minimum, left.maximum) + rightCost[i + 1];
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestSplit = i;
+				}
+			}
+			if (bestSplit >= 0)
+			{
+				auto split = std::partition(inputs.begin() + task.begin, inputs.begin() + task.end,
+					[&](const BuildInput& input) { return binOf(input) <= bestSplit; });
+				middle = split - inputs.begin();
+			}
+		}
+		if (middle == task.begin || middle == task.end)
+			middle = task.begin + (task.end - task.begin) / 2;
+
+		tasks.push_back({ middle, task.end, index });
+		tasks.push_back({ task.begin, middle, index });
+	}
+
+	//Children always come after their parent, so a reverse sweep sees them finished
+	for (size_t i = result.nodes.size(); i-- > 0;)
+	{
+		Node& node = result.nodes[i];
+		if (node.IsLeaf())
+			continue;
+		const Node& child1 = result.nodes[node.child1];
+		const Node& child2 = result.nodes[node.child2];
+		Union(child1.minimum, child1.maximum, child2.minimum, child2.maximum, node.minimum, node.maximum);
+		node.height = 1 + (std::max)(child1.height, child2.height);
+	}
+	return result;
+}
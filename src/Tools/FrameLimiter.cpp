@@ -0,0 +1,64 @@
+#include "Tools/FrameLimiter.h"
+
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
+FrameLimiter::FrameLimiter(float targetFps)
+{
+	QueryPerformanceFrequency((LARGE_INTEGER*)&mCountsPerSecond);
+	//High resolution timers need Windows 10 1803, older versions get a regular one and spin longer
+	mTimer = CreateWaitableTimerExW(nullptr, nullptr, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	float spinSeconds = kSpinSeconds;
+	if (mTimer == nullptr)
+	{
+		mTimer = CreateWaitableTimerExW(nullptr, nullptr, 0, TIMER_ALL_ACCESS);
+		spinSeconds = kCoarseSpinSeconds;
+	}
+	mSpinCounts = static_cast<__int64>(mCountsPerSecond * spinSeconds);
+	SetTargetFps(targetFps);
+}
+FrameLimiter::~FrameLimiter()
+{
+	if (mTimer != nullptr)
+		CloseHandle(mTimer);
+}
+void FrameLimiter::SetTargetFps(float targetFps)
+{
+	mTargetFps = targetFps > 0.0f ? targetFps : 0.0f;
+	mFramePeriod = mTargetFps > 0.0f ? static_cast<__int64>(mCountsPerSecond / mTargetFps) : 0;
+	mNextFrame = 0;
+}
+__int64 FrameLimiter::Now() const
+{
+	__int64 now;
+	QueryPerformanceCounter((LARGE_INTEGER*)&now);
+	return now;
+}
+void FrameLimiter::WaitForNextFrame()
+{
+	if (mFramePeriod == 0)
+		return;
+	__int64 now = Now();
+	//First frame, or so far behind that catching up would only burst frames
+	if (mNextFrame == 0 || now - mNextFrame > mFramePeriod)
+	{
+		mNextFrame = now + mFramePeriod;
+		return;
+	}
+
+	__int64 sleepCounts = mNextFrame - now - mSpinCounts;
+	if (sleepCounts > 0 && mTimer != nullptr)
+	{
+		//Relative due time in 100ns units
+		LARGE_INTEGER dueTime;
+		dueTime.QuadPart = -(sleepCounts * 10000000 / mCountsPerSecond);
+		if (dueTime.QuadPart < 0 && SetWaitableTimer(mTimer, &dueTime, 0, nullptr, nullptr, FALSE))
+			WaitForSingleObject(mTimer, INFINITE);
+	}
+	while (Now() < mNextFrame)
+	{
+		YieldProcessor();
+	}
+	mNextFrame += mFramePeriod;
+}
@@ -0,0 +1,138 @@
+#include "Tools/FramePacer.h"
+#include "DXSampleHelper.h"
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace
+{
+	//GPU that never finishes on its own, a wait completes exactly the value asked for
+	class FakeFence : public FramePacer::Fence
+	{
+	public:
+		UINT64 CompletedValue() const override { return completed; }
+		void Wait(UINT64 value) override
+		{
+			waits.push_back(value);
+			completed = value;
+		}
+
+		UINT64 completed = 0;
+		std::vector<UINT64> waits;
+	};
+}
+
+FramePacer::FramePacer(Fence& fence, UINT framesInFlight) :
+	mFence(fence),
+	mFramesInFlight((std::min)((std::max)(framesInFlight, 1u), kMaxFramesInFlight)),
+	//The first BeginFrame() wraps around to slot 0
+	mSlot(mFramesInFlight - 1)
+{
+}
+UINT FramePacer::BeginFrame()
+{
+	mSlot = (mSlot + 1) % mFramesInFlight;
+	auto start = std::chrono::steady_clock::now();
+	WaitFor(mSlotFences[mSlot]);
+	mSlotFences[mSlot] = 0;
+	mLastWaitMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	mAverageWaitMs += (mLastWaitMs - mAverageWaitMs) * kWaitSmoothing;
+	mPeakWaitMs = (std::max)(mPeakWaitMs, mLastWaitMs);
+	return mSlot;
+}
+void FramePacer::EndFrame(UINT64 fenceValue)
+{
+	mSlotFences[mSlot] = fenceValue;
+	mLastFence = (std::max)(mLastFence, fenceValue);
+}
+void FramePacer::WaitIdle()
+{
+	WaitFor(mLastFence);
+	std::fill(std::begin(mSlotFences), std::end(mSlotFences), 0);
+}
+void FramePacer::SetFramesInFlight(UINT framesInFlight)
+{
+	WaitIdle();
+	mFramesInFlight = (std::min)((std::max)(framesInFlight, 1u), kMaxFramesInFlight);
+	mSlot = mFramesInFlight - 1;
+}
+bool FramePacer::SelfTest()
+{
+	bool passed = true;
+	auto check = [&passed](bool condition, const char* what)
+	{
+		if (condition)
+			return;
+		char text[256];
+		sprintf_s(text, "FramePacer self-test failed: %s\n", what);
+		OutputDebugStringA(text);
+		passed = false;
+	};
+
+	FakeFence fence;
+	FramePacer pacer(fence, 3);
+	UINT64 fenceValue = 0;
+	//Slots come in ring order and the first lap has nothing to wait for
+	for (UINT frame = 0; frame < 3; ++frame)
+	{
+		check(pacer.BeginFrame() == frame, "first lap slot order");
+		pacer.EndFrame(++fenceValue);
+	}
+	check(fence.waits.empty(), "first lap waited");
+
+	//Reusing a slot waits for the frame submitted from it three frames ago
+	check(pacer.BeginFrame() == 0, "slot after wrap around");
+	check(fence.waits.size() == 1 && fence.waits.back() == 1, "wait on reuse of slot 0");
+	pacer.EndFrame(++fenceValue);
+	//Already finished frames do not wait
+	fence.completed = fenceValue;
+	check(pacer.BeginFrame() == 1, "slot after reuse");
+	check(fence.waits.size() == 1, "waited on a finished frame");
+	pacer.EndFrame(++fenceValue);
+
+	//Draining waits for the newest frame, the ring restarts at slot 0 without waiting
+	size_t waits = fence.waits.size();
+	pacer.SetFramesInFlight(2);
+	check(fence.waits.size() == waits + 1 && fence.waits.back() == fenceValue, "drain waits for the last frame");
+	check(pacer.FramesInFlight() == 2, "frames in flight after change");
+	check(pacer.BeginFrame() == 0, "slot after drain");
+	pacer.EndFrame(++fenceValue);
+	check(pacer.BeginFrame() == 1, "second slot after drain");
+	pacer.EndFrame(++fenceValue);
+	check(fence.waits.size() == waits + 1, "waited on a drained slot");
+	check(pacer.BeginFrame() == 0, "wrap around at the new depth");
+	check(fence.waits.back() == fenceValue - 1, "wait on reuse at the new depth");
+	pacer.EndFrame(++fenceValue);
+
+	pacer.SetFramesInFlight(0);
+	check(pacer.FramesInFlight() == 1, "depth clamped to 1");
+	pacer.SetFramesInFlight(kMaxFramesInFlight + 1);
+	check(pacer.FramesInFlight() == kMaxFramesInFlight, "depth clamped to kMaxFramesInFlight");
+
+	if (passed)
+		OutputDebugStringA("FramePacer self-test passed\n");
+	return passed;
+}
+void FramePacer::WaitFor(UINT64 value)
+{
+	if (value != 0 && mFence.CompletedValue() < value)
+		mFence.Wait(value);
+}
+
+D3D12FenceWaiter::D3D12FenceWaiter(ID3D12Fence* fence) :
+	mFence(fence),
+	mEvent(CreateEventEx(nullptr, nullptr, 0, EVENT_ALL_ACCESS))
+{
+	if (mEvent == nullptr)
+		ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
+}
+D3D12FenceWaiter::~D3D12FenceWaiter()
+{
+	CloseHandle(mEvent);
+}
+void D3D12FenceWaiter::Wait(UINT64 value)
+{
+	//Auto reset event, a wait consumes the signal
+	ThrowIfFailed(mFence->SetEventOnCompletion(value, mEvent));
+	WaitForSingleObject(mEvent, INFINITE);
+}
@@ -0,0 +1,181 @@
+#include "Tools/FrustumCuller.h"
+#include "Tools/GeometryGenerator.h"
+#include <cassert>
+#include <chrono>
+#include <random>
+
+using namespace DirectX;
+
+FrustumCuller::FrustumCuller()
+{
+	for (auto& plane : mPlanes)
+	{
+		plane = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+	}
+}
+void FrustumCuller::SetViewProj(FXMMATRIX viewProj)
+{
+	//Row vectors: clip = p * viewProj, so the planes are sums of its columns
+	XMMATRIX columns = XMMatrixTranspose(viewProj);
+	XMVECTOR planes[6] = {
+		XMVectorAdd(columns.r[3], columns.r[0]),      //left   -w <= x
+		XMVectorSubtract(columns.r[3], columns.r[0]), //right   x <= w
+		XMVectorAdd(columns.r[3], columns.r[1]),      //bottom -w <= y
+		XMVectorSubtract(columns.r[3], columns.r[1]), //top     y <= w
+		columns.r[2],                                 //near    0 <= z
+		XMVectorSubtract(columns.r[3], columns.r[2]), //far     z <= w
+	};
+	for (size_t i = 0; i < 6; ++i)
+	{
+		XMStoreFloat4(&mPlanes[i], XMPlaneNormalize(planes[i]));
+	}
+}
+void FrustumCuller::Clear()
+{
+	mCount = 0;
+	mCenterX.clear(); mCenterY.clear(); mCenterZ.clear();
+	mExtentX.clear(); mExtentY.clear(); mExtentZ.clear();
+}
+UINT FrustumCuller::Add(const BoundingBox& aabb)
+{
+	if (mCount % 4 == 0)
+	{
+		//Padding lanes hold empty boxes at the origin, their results are never reported
+		size_t size = mCount + 4;
+		mCenterX.resize(size); mCenterY.resize(size); mCenterZ.resize(size);
+		mExtentX.resize(size); mExtentY.resize(size); mExtentZ.resize(size);
+	}
+	mCenterX[mCount] = aabb.Center.x;
+	mCenterY[mCount] = aabb.Center.y;
+	mCenterZ[mCount] = aabb.Center.z;
+	mExtentX[mCount] = aabb.Extents.x;
+	mExtentY[mCount] = aabb.Extents.y;
+	mExtentZ[mCount] = aabb.Extents.z;
+	return mCount++;
+}
+void FrustumCuller::Cull(std::vector<UINT>& visible) const
+{
+	//Splatted plane components and their absolute values, loaded once
+	XMVECTOR planeX[6], planeY[6], planeZ[6], planeW[6];
+	XMVECTOR absX[6], absY[6], absZ[6];
+	for (size_t p = 0; p < 6; ++p)
+	{
+		planeX[p] = XMVectorReplicate(mPlanes[p].x);
+		planeY[p] = XMVectorReplicate(mPlanes[p].y);
+		planeZ[p] = XMVectorReplicate(mPlanes[p].z);
+		planeW[p] = XMVectorReplicate(mPlanes[p].w);
+		absX[p] = XMVectorAbs(planeX[p]);
+		absY[p] = XMVectorAbs(planeY[p]);
+		absZ[p] = XMVectorAbs(planeZ[p]);
+	}
+	const XMVECTOR zero = XMVectorZero();
+	for (UINT i = 0; i < mCount; i += 4)
+	{
+		XMVECTOR cx = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&mCenterX[i]));
+		XMVECTOR cy = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&mCenterY[i]));
+		XMVECTOR cz = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&mCenterZ[i]));
+		XMVECTOR ex = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&mExtentX[i]));
+		XMVECTOR ey = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&mExtentY[i]));
+		XMVECTOR ez = XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(&mExtentZ[i]));
+
+		//Outside when the box is entirely behind one plane: dot(plane, center) + dot(|normal|, extents) < 0
+		XMVECTOR outside = XMVectorFalseInt();
+		for (size_t p = 0; p < 6; ++p)
+		{
+			XMVECTOR distance = XMVectorMultiplyAdd(cx, planeX[p], planeW[p]);
+			distance = XMVectorMultiplyAdd(cy, planeY[p], distance);
+			distance = XMVectorMultiplyAdd(cz, planeZ[p], distance);
+			XMVECTOR radius = XMVectorMultiply(ex, absX[p]);
+			radius = XMVectorMultiplyAdd(ey, absY[p], radius);
+			radius = XMVectorMultiplyAdd(ez, absZ[p], radius);
+			outside = XMVectorOrInt(outside, XMVectorLess(XMVectorAdd(distance, radius), zero));
+		}
+#if defined(_XM_SSE_INTRINSICS_)
+		int mask = _mm_movemask_ps(outside);
+#else
+		XMUINT4 lanes;
+		XMStoreUInt4(&lanes, outside);
+		int mask = (lanes.x ? 1 : 0) | (lanes.y ? 2 : 0) | (lanes.z ? 4 : 0) | (lanes.w ? 8 : 0);
+#endif
+		UINT lanesUsed = (mCount - i) < 4 ? (mCount - i) : 4;
+		for (UINT lane = 0; lane < lanesUsed; ++lane)
+		{
+			if (!(mask & (1 << lane)))
+				visible.push_back(i + lane);
+		}
+	}
+}
+bool FrustumCuller::IsVisible(const BoundingBox& aabb) const
+{
+	for (auto& plane : mPlanes)
+	{
+		float distance = plane.x * aabb.Center.x + plane.y * aabb.Center.y + plane.z * aabb.Center.z + plane.w;
+		float radius = fabsf(plane.x) * aabb.Extents.x + fabsf(plane.y) * aabb.Extents.y + fabsf(plane.z) * aabb.Extents.z;
+		if (distance + radius < 0.0f)
+			return false;
+	}
+	return true;
+}
+void FrustumCuller::Benchmark(UINT boxCount)
+{
+	//Unit box scattered, scaled and rotated through a 2000 unit cube around the camera
+	GeometryGenerator geoGen;
+	GeometryGenerator::MeshData box = geoGen.BuildBox(1.0f, 1.0f, 1.0f);
+	BoundingBox localAabb;
+	BoundingSphere localSphere;
+	//BuildBox() puts its indices into the first group
+	const std::vector<uint32_t>& boxIndices = box.idxGroups[0].indices;
+	GeometryGenerator::ComputeBounds(box.vertices, boxIndices.data(), boxIndices.size(), localAabb, localSphere);
+	assert(localAabb.Extents.x > 0.0f && localAabb.Extents.y > 0.0f && localAabb.Extents.z > 0.0f);
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-1000.0f, 1000.0f);
+	std::uniform_real_distribution<float> scale(1.0f, 20.0f);
+	std::uniform_real_distribution<float> angle(0.0f, XM_2PI);
+	std::vector<BoundingBox> boxes(boxCount);
+	for (auto& aabb : boxes)
+	{
+		XMMATRIX world = XMMatrixScaling(scale(random), scale(random), scale(random));
+		world = XMMatrixMultiply(world, XMMatrixRotationY(angle(random)));
+		world = XMMatrixMultiply(world, XMMatrixTranslation(position(random), position(random), position(random)));
+		localAabb.Transform(aabb, world);
+	}
+
+	XMMATRIX view = XMMatrixLookAtLH(XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f), XMVectorSet(0.0f, 0.0f, 1.0f, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+	XMMATRIX proj = XMMatrixPerspectiveFovLH(0.25f * XM_PI, 16.0f / 9.0f, 1.0f, 1000.0f);
+	FrustumCuller culler;
+	culler.SetViewProj(XMMatrixMultiply(view, proj));
+
+	const int kRuns = 20;
+	std::vector<UINT> visible;
+	visible.reserve(boxCount);
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int run = 0; run < kRuns; ++run)
+	{
+		culler.Clear();
+		for (auto& aabb : boxes)
+		{
+			culler.Add(aabb);
+		}
+		visible.clear();
+		culler.Cull(visible);
+	}
+	auto middle = std::chrono::high_resolution_clock::now();
+	size_t scalarVisible = 0;
+	for (int run = 0; run < kRuns; ++run)
+	{
+		scalarVisible = 0;
+		for (auto& aabb : boxes)
+		{
+			scalarVisible += culler.IsVisible(aabb) ? 1 : 0;
+		}
+	}
+	auto end = std::chrono::high_resolution_clock::now();
+
+	double simdMs = std::chrono::duration<double, std::milli>(middle - start).count() / kRuns;
+	double scalarMs = std::chrono::duration<double, std::milli>(end - middle).count() / kRuns;
+	char buffer[256];
+	sprintf_s(buffer, "Frustum culling %u boxes: SoA x4 %.3f ms (including fill), scalar %.3f ms, visible %zu / %zu\n",
+		boxCount, simdMs, scalarMs, visible.size(), scalarVisible);
+	OutputDebugStringA(buffer);
+}
@@ -1,4 +1,7 @@
 #include "Tools/GeometryGenerator.h"
+#include "Tools/MappedFile.h"
+#include "Tools/ObjChunkParser.h"
+#include "Tools/VertexWeldTable.h"
 
 GeometryGenerator::MeshData GeometryGenerator::BuildCylinder(
 	float bottomR, float topR, float height, uint32_t slice, uint32_t stack)
@@ -181,11 +184,32 @@ GeometryGenerator::MeshData GeometryGenerator::BuildGrid(float width, float dept
 	meshData.idxGroups.push_back(group);
 	return meshData;
 }
-void GeometryGenerator::ReadObjFile(std::string path, std::string fileName, std::vector<GeometryGenerator::MeshData>& storage, std::vector<MaterialLoader::Material>& mtlList)
+void GeometryGenerator::ReadObjFile(std::string path, std::string fileName, std::vector<GeometryGenerator::MeshData>& storage, std::vector<MaterialLoader::Material>& mtlList, JobSystem* jobs)
 {
-	std::ifstream objFile;
-	objFile.open(path + "\\" + fileName);
-	std::string line;
+	//The whole file is mapped, split on line boundaries and tokenized in place on worker threads.
+	MappedFile objFile;
+	if (!objFile.Open(path + "\\" + fileName))
+	{
+		OutputDebugStringA(("Failed to open " + path + "\\" + fileName + "\n").c_str());
+	}
+	std::vector<ObjChunk> chunks;
+	ObjChunkParser::Parse(objFile.Data(), objFile.End(), chunks, jobs);
+
+	//Deterministic merge: attribute lists are concatenated and the statements of every chunk
+	//are replayed in file order, so the result does not depend on the number of chunks.
+	std::vector<DirectX::XMFLOAT3> tempV;
+	std::vector<DirectX::XMFLOAT2> tempVt;
+	std::vector<DirectX::XMFLOAT3> tempVn;
+	std::vector<size_t> vBase, vtBase, vnBase;
+	for (auto& chunk : chunks)
+	{
+		vBase.push_back(tempV.size());
+		vtBase.push_back(tempVt.size());
+		vnBase.push_back(tempVn.size());
+		tempV.insert(tempV.end(), chunk.positions.begin(), chunk.positions.end());
+		tempVt.insert(tempVt.end(), chunk.texCoords.begin(), chunk.texCoords.end());
+		tempVn.insert(tempVn.end(), chunk.normals.begin(), chunk.normals.end());
+	}
 
 	auto& meshDataGroup = storage;
 
@@ -196,31 +220,51 @@ void GeometryGenerator::ReadObjFile(std::string path, std::string fileName, std:
 
 	std::string meshName;
 
-	int currentVertexIndex = 0;
+	//Corners are welded per mesh, indices of one MeshData never point into another.
+	//The table grows to the largest mesh, not to the vertex count of the whole file.
+	VertexWeldTable weldTable;
 
-	std::vector<DirectX::XMFLOAT3> tempV;
-	std::vector<DirectX::XMFLOAT2> tempVt;
-	std::vector<DirectX::XMFLOAT3> tempVn;
-
-	std::unordered_map<Vertex, int> vertexIndexMap;
-
-	while (std::getline(objFile, line))
+	for (size_t c = 0; c < chunks.size(); ++c)
 	{
-		std::vector<std::string> lineParts = SplitString(line, ' ');
-		if (lineParts.size() > 0)
+		auto& chunk = chunks[c];
+		size_t cornerIndex = 0;
+		auto emitCorners = [&](size_t cornerEnd)
 		{
-			if (lineParts[0] == "mtllib")
+			for (; cornerIndex < cornerEnd; ++cornerIndex)
+			{
+				const ObjCorner& corner = chunk.corners[cornerIndex];
+				int positionIndex = ObjChunkParser::ResolveCorner(corner.v, vBase[c]);
+				int texIndex = ObjChunkParser::ResolveCorner(corner.vt, vtBase[c]);
+				int normalIndex = ObjChunkParser::ResolveCorner(corner.vn, vnBase[c]);
+
+				//Attributes are only fetched for corners that produce a new vertex
+				uint32_t index;
+				if (weldTable.FindOrInsert(positionIndex, texIndex, normalIndex, (uint32_t)currentMeshData.vertices.size(), index))
+				{
+					DirectX::XMFLOAT3 position = tempV[positionIndex]; //v
+					DirectX::XMFLOAT2 tex = texIndex >= 0 ? tempVt[texIndex] : DirectX::XMFLOAT2(0.0f, 0.0f); //vt
+					DirectX::XMFLOAT3 normal = normalIndex >= 0 ? tempVn[normalIndex] : DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f); //vn
+					currentMeshData.vertices.push_back(Vertex(position, normal, DirectX::XMFLOAT3(), tex));
+				}
+				currentIdxGroup.indices.push_back(index);
+			}
+		};
+		for (auto& statement : chunk.statements)
+		{
+			//Faces before the statement belong to the current group
+			emitCorners(statement.cornerOffset);
+			if (statement.type == ObjStatement::MtlLib)
 			{
 				MaterialLoader mtlLoader;
-				mtlLoader.ReadMtlFile(path, lineParts[1], mtlList);
+				mtlLoader.ReadMtlFile(path, statement.name, mtlList);
 			}
 			//MeshData Triangle Indices and corresponding face Matrial
-			if (lineParts[0] == "g")
+			if (statement.type == ObjStatement::Group)
 			{
 				gSign = true;
-				meshName = lineParts[1] != "group" ? lineParts[1] : lineParts[2];
+				meshName = statement.name;
 			}
-			if (lineParts[0] == "usemtl")
+			if (statement.type == ObjStatement::UseMtl)
 			{
 				//Do not push first mesh into groups now. The indices currentIdxGroup are empty now.
 				if (firstMesh)
@@ -228,12 +272,13 @@ void GeometryGenerator::ReadObjFile(std::string path, std::string fileName, std:
 				else
 				{
 					//Next indices group coming. Save present.
-					currentMeshData.idxGroups.push_back(currentIdxGroup);
+					currentMeshData.idxGroups.push_back(std::move(currentIdxGroup));
 					if (gSign)
 					{
 						//Next mesh data coming. Save
-						meshDataGroup.push_back(currentMeshData);
+						meshDataGroup.push_back(std::move(currentMeshData));
 						currentMeshData = MeshData();
+						weldTable.Reset();
 						//Wait for next mesh indices(g and usemtl)
 						gSign = false;
 					}
@@ -242,62 +287,14 @@ void GeometryGenerator::ReadObjFile(std::string path, std::string fileName, std:
 				}
 				//Fill in names
 				currentMeshData.name = meshName;
-				currentIdxGroup.mtlName = lineParts[1];
-			}
-			if (lineParts[0] == "f")
-			{
-				for (int i = 1; i < lineParts.size(); ++i)
-				{
-					auto vertexInfo = SplitString(lineParts[i], '/');
-					int vertexIndex = std::stoi(vertexInfo[0]) - 1;//Index in file starts from 1
-					DirectX::XMFLOAT3& position = tempV[vertexIndex]; //v
-					DirectX::XMFLOAT2& tex = tempVt[std::stoi(vertexInfo[1]) - 1]; //vt
-					DirectX::XMFLOAT3& normal = tempVn[std::stoi(vertexInfo[2]) - 1]; //vn
-
-					Vertex v(position, normal, DirectX::XMFLOAT3(), tex);
-					if (vertexIndexMap.find(v) == vertexIndexMap.end())
-					{
-						currentMeshData.vertices.push_back(v);
-						int indexInCurrentMesh = currentMeshData.vertices.size() - 1;
-						currentIdxGroup.indices.push_back(indexInCurrentMesh);
-						vertexIndexMap.emplace(v, indexInCurrentMesh);
-					}
-					else
-					{
-						currentIdxGroup.indices.push_back(vertexIndexMap[v]);
-					}
-				}
-			}
-			//MeshData Vertices
-			if (lineParts[0] == "v")
-			{
-				tempV.push_back(DirectX::XMFLOAT3(
-					std::stof(lineParts[1]),
-					std::stof(lineParts[2]),
-					std::stof(lineParts[3])
-				));
-			}
-			if (lineParts[0] == "vt")
-			{
-				tempVt.push_back(DirectX::XMFLOAT2(
-					std::stof(lineParts[1]),
-					std::stof(lineParts[2])
-				));
-			}
-			if (lineParts[0] == "vn")
-			{
-				tempVn.push_back(DirectX::XMFLOAT3(
-					std::stof(lineParts[1]),
-					std::stof(lineParts[2]),
-					std::stof(lineParts[3])
-				));
+				currentIdxGroup.mtlName = statement.name;
 			}
 		}
+		emitCorners(chunk.corners.size());
 	}
-	currentMeshData.idxGroups.push_back(currentIdxGroup);
-	meshDataGroup.push_back(currentMeshData); //last one
-
-	objFile.close();
+	currentMeshData.idxGroups.push_back(std::move(currentIdxGroup));
+	meshDataGroup.push_back(std::move(currentMeshData)); //last one
+	weldTable.Report(fileName);
 }
 void GeometryGenerator::ReadObjFileInOne(std::string path, std::string fileName, GeometryGenerator::MeshData& storage)
 {
@@ -373,4 +370,34 @@ void GeometryGenerator::ReadObjFileInOne(std::string path, std::string fileName,
 	OutputDebugString(std::to_wstring(vn).c_str());
 
 	objFile.close();
-}
\ No newline at end of file
+}
+
+void GeometryGenerator::ComputeBounds(const std::vector<Vertex>& vertices, const uint32_t* indices, size_t indexCount,
+	DirectX::BoundingBox& aabb, DirectX::BoundingSphere& sphere)
+{
+	aabb = DirectX::BoundingBox(DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f), DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f));
+	sphere = DirectX::BoundingSphere(DirectX::XMFLOAT3(0.0f, 0.0f, 0.0f), 0.0f);
+	if (indexCount == 0)
+		return;
+	DirectX::XMVECTOR minimum = DirectX::XMLoadFloat3(&vertices[indices[0]].position);
+	DirectX::XMVECTOR maximum = minimum;
+	for (size_t i = 1; i < indexCount; ++i)
+	{
+		DirectX::XMVECTOR p = DirectX::XMLoadFloat3(&vertices[indices[i]].position);
+		minimum = DirectX::XMVectorMin(minimum, p);
+		maximum = DirectX::XMVectorMax(maximum, p);
+	}
+	DirectX::XMVECTOR center = DirectX::XMVectorScale(DirectX::XMVectorAdd(minimum, maximum), 0.5f);
+	DirectX::XMStoreFloat3(&aabb.Center, center);
+	DirectX::XMStoreFloat3(&aabb.Extents, DirectX::XMVectorScale(DirectX::XMVectorSubtract(maximum, minimum), 0.5f));
+
+	//Squared distances first, a single sqrt at the end
+	DirectX::XMVECTOR radiusSq = DirectX::XMVectorZero();
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		DirectX::XMVECTOR offset = DirectX::XMVectorSubtract(DirectX::XMLoadFloat3(&vertices[indices[i]].position), center);
+		radiusSq = DirectX::XMVectorMax(radiusSq, DirectX::XMVector3LengthSq(offset));
+	}
+	sphere.Center = aabb.Center;
+	sphere.Radius = DirectX::XMVectorGetX(DirectX::XMVectorSqrt(radiusSq));
+}
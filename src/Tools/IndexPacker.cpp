@@ -0,0 +1,61 @@
+#include "Tools/IndexPacker.h"
+
+void IndexPacker::Split(std::vector<uint32_t>& indices, std::vector<GeometryGenerator::Vertex>& vertices, std::vector<Range>& ranges, uint32_t maxSpan)
+{
+	size_t triangleCount = indices.size() / 3;
+	Range current;
+	uint32_t rangeMin = 0, rangeMax = 0;
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		uint32_t* triangle = &indices[t * 3];
+		uint32_t triangleMin = triangle[0], triangleMax = triangle[0];
+		for (size_t k = 1; k < 3; ++k)
+		{
+			triangleMin = triangle[k] < triangleMin ? triangle[k] : triangleMin;
+			triangleMax = triangle[k] > triangleMax ? triangle[k] : triangleMax;
+		}
+		if (triangleMax - triangleMin >= maxSpan)
+		{
+			//Copies are appended next to each other, later copies can share the same range
+			for (size_t k = 0; k < 3; ++k)
+			{
+				GeometryGenerator::Vertex copy = vertices[triangle[k]];
+				vertices.push_back(copy);
+				triangle[k] = static_cast<uint32_t>(vertices.size() - 1);
+			}
+			triangleMin = triangle[0];
+			triangleMax = triangle[2];
+		}
+
+		if (current.indexCount > 0)
+		{
+			uint32_t newMin = triangleMin < rangeMin ? triangleMin : rangeMin;
+			uint32_t newMax = triangleMax > rangeMax ? triangleMax : rangeMax;
+			if (newMax - newMin < maxSpan)
+			{
+				rangeMin = newMin;
+				rangeMax = newMax;
+				current.indexCount += 3;
+				continue;
+			}
+			current.baseVertex = rangeMin;
+			ranges.push_back(current);
+		}
+		current.firstIndex = t * 3;
+		current.indexCount = 3;
+		rangeMin = triangleMin;
+		rangeMax = triangleMax;
+	}
+	if (current.indexCount > 0)
+	{
+		current.baseVertex = rangeMin;
+		ranges.push_back(current);
+	}
+}
+void IndexPacker::Pack(const std::vector<uint32_t>& indices, const Range& range, std::vector<uint16_t>& packed)
+{
+	for (size_t i = range.firstIndex; i < range.firstIndex + range.indexCount; ++i)
+	{
+		packed.push_back(static_cast<uint16_t>(indices[i] - range.baseVertex));
+	}
+}
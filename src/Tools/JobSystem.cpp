@@ -0,0 +1,123 @@
+#include "Tools/JobSystem.h"
+
+namespace
+{
+	//Pool and queue of the worker running on this thread
+	thread_local const JobSystem* tOwner = nullptr;
+	thread_local UINT tQueueIndex = 0;
+}
+
+JobSystem::JobSystem(UINT workerCount)
+{
+	if (workerCount == 0)
+	{
+		UINT hardwareThreads = std::thread::hardware_concurrency();
+		workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+	for (UINT i = 0; i <= workerCount; ++i)
+	{
+		mQueues.push_back(std::make_unique<Queue>());
+	}
+	for (UINT i = 0; i < workerCount; ++i)
+	{
+		mWorkers.emplace_back(&JobSystem::WorkerLoop, this, i);
+	}
+}
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+		mStop = true;
+	}
+	mWake.notify_all();
+	for (auto& worker : mWorkers)
+	{
+		worker.join();
+	}
+}
+UINT JobSystem::CurrentQueue() const
+{
+	return tOwner == this ? tQueueIndex : static_cast<UINT>(mQueues.size() - 1);
+}
+void JobSystem::Run(std::function<void()> job, Counter* counter, const Counter* dependency)
+{
+	if (counter)
+		counter->value.fetch_add(1, std::memory_order_relaxed);
+	Queue& queue = *mQueues[CurrentQueue()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back({ std::move(job), counter, dependency });
+	}
+	mQueuedJobs.fetch_add(1, std::memory_order_release);
+	//Taking the lock orders the push before a worker going to sleep checks mQueuedJobs
+	{
+		std::lock_guard<std::mutex> lock(mSleepMutex);
+	}
+	mWake.notify_one();
+}
+bool JobSystem::TryRunJob()
+{
+	const UINT queueCount = static_cast<UINT>(mQueues.size());
+	const UINT own = CurrentQueue();
+	Job job;
+	bool found = false;
+	for (UINT i = 0; i < queueCount && !found; ++i)
+	{
+		UINT index = (own + i) % queueCount;
+		Queue& queue = *mQueues[index];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty())
+			continue;
+		//Newest of our own jobs is still warm in cache, the oldest of others is the largest piece left
+		if (i == 0)
+		{
+			job = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		}
+		else
+		{
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+		}
+		found = true;
+	}
+	if (!found)
+		return false;
+
+	if (job.dependency && !job.dependency->Done())
+	{
+		//Not ready, back to the far end of the queue and let the dependency make progress
+		Queue& queue = *mQueues[own];
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.jobs.push_front(std::move(job));
+		}
+		std::this_thread::yield();
+		return false;
+	}
+	mQueuedJobs.fetch_sub(1, std::memory_order_relaxed);
+	job.function();
+	if (job.counter)
+		job.counter->value.fetch_sub(1, std::memory_order_release);
+	return true;
+}
+void JobSystem::Wait(const Counter& counter)
+{
+	while (!counter.Done())
+	{
+		if (!TryRunJob())
+			std::this_thread::yield();
+	}
+}
+void JobSystem::WorkerLoop(UINT index)
+{
+	tOwner = this;
+	tQueueIndex = index;
+	while (!mStop.load(std::memory_order_relaxed))
+	{
+		if (TryRunJob())
+			continue;
+		std::unique_lock<std::mutex> lock(mSleepMutex);
+		mWake.wait(lock, [this]() { return mStop.load(std::memory_order_relaxed) || mQueuedJobs.load(std::memory_order_acquire) > 0; });
+	}
+}
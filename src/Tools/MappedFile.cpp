@@ -0,0 +1,52 @@
+#include "Tools/MappedFile.h"
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+bool MappedFile::Open(const std::string& fileName)
+{
+	Close();
+	mFile = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (mFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(mFile, &fileSize))
+	{
+		Close();
+		return false;
+	}
+	mSize = static_cast<size_t>(fileSize.QuadPart);
+	//Zero-length files cannot be mapped, leave an empty view
+	if (mSize == 0)
+		return true;
+
+	mMapping = CreateFileMappingA(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMapping == nullptr)
+	{
+		Close();
+		return false;
+	}
+	mData = static_cast<const char*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+	if (mData == nullptr)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+void MappedFile::Close()
+{
+	if (mData != nullptr)
+		UnmapViewOfFile(mData);
+	if (mMapping != nullptr)
+		CloseHandle(mMapping);
+	if (mFile != INVALID_HANDLE_VALUE)
+		CloseHandle(mFile);
+	mData = nullptr;
+	mMapping = nullptr;
+	mFile = INVALID_HANDLE_VALUE;
+	mSize = 0;
+}
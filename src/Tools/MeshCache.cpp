@@ -0,0 +1,209 @@
+#include "Tools/MeshCache.h"
+#include "Tools/ObjTokenizer.h"
+#include <fstream>
+
+namespace
+{
+	//Serialized submesh: counts and offsets followed by the two names
+	struct SubmeshRecord
+	{
+		uint32_t indexCount;
+		uint32_t startIndexLocation;
+		int32_t baseVertexLocation;
+		uint32_t firstMeshlet;
+		uint32_t meshletCount;
+		uint32_t lodLevel;
+		uint32_t lodCount;
+		DirectX::BoundingBox aabb;
+		DirectX::BoundingSphere sphere;
+		uint16_t meshNameLength;
+		uint16_t materialNameLength;
+	};
+	uint64_t AlignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+uint64_t MeshCache::HashBytes(const void* data, size_t size, uint64_t seed)
+{
+	//Word-at-a-time multiply/rotate mix, fast enough to hash large sources on every launch
+	const uint64_t k0 = 0x9E3779B97F4A7C15ull;
+	const uint64_t k1 = 0xC2B2AE3D27D4EB4Full;
+	const BYTE* bytes = static_cast<const BYTE*>(data);
+	uint64_t hash = seed ^ (size * k0);
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, bytes + i, sizeof(word));
+		word *= k1;
+		word = (word << 31) | (word >> 33);
+		hash ^= word * k0;
+		hash = ((hash << 27) | (hash >> 37)) * k0 + k1;
+	}
+	uint64_t tail = 0;
+	memcpy(&tail, bytes + i, size - i);
+	hash ^= tail * k1;
+	//Final avalanche
+	hash ^= hash >> 33;
+	hash *= k1;
+	hash ^= hash >> 29;
+	return hash;
+}
+uint64_t MeshCache::HashSource(const std::string& path, const std::string& objFileName, std::vector<std::string>& mtlLibs)
+{
+	MappedFile objFile;
+	if (!objFile.Open(path + "\\" + objFileName))
+		return 0;
+	uint64_t hash = HashBytes(objFile.Data(), objFile.Size(), kVersion);
+
+	//Material libraries are part of the key as well
+	ObjTokenizer tokenizer(objFile.Data(), objFile.End());
+	ObjLine line;
+	while (tokenizer.NextLine(line))
+	{
+		if (line.cur == line.end || *line.cur != 'm')
+			continue;
+		if (line.NextToken() != "mtllib")
+			continue;
+		mtlLibs.emplace_back(line.Rest());
+		MappedFile mtlFile;
+		if (mtlFile.Open(path + "\\" + mtlLibs.back()))
+			hash = HashBytes(mtlFile.Data(), mtlFile.Size(), hash);
+	}
+	return hash;
+}
+bool MeshCache::Load(const std::string& cacheFile, uint64_t sourceHash, MappedFile& file, View& view)
+{
+	if (!file.Open(cacheFile))
+		return false;
+	//Release the stale file on a miss so it can be rewritten
+	auto miss = [&file]()
+	{
+		file.Close();
+		return false;
+	};
+	Header header;
+	if (file.Size() < sizeof(Header))
+		return miss();
+	memcpy(&header, file.Data(), sizeof(Header));
+	if (header.magic != kMagic || header.version != kVersion || header.sourceHash != sourceHash)
+		return miss();
+	uint64_t vertexBytes = uint64_t(header.vertexCount) * header.vertexStride;
+	uint64_t indexBytes = uint64_t(header.indexCount) * header.indexStride;
+	uint64_t meshletBytes = uint64_t(header.meshletCount) * sizeof(Meshlet);
+	if (header.vertexDataOffset + vertexBytes > file.Size() || header.indexDataOffset + indexBytes > file.Size() ||
+		header.meshletDataOffset + meshletBytes > file.Size() || header.lodCount > MeshSimplifier::kMaxLodLevels + 1)
+		return miss();
+
+	view.vertexFormat = header.vertexFormat;
+	view.positionScale = header.positionScale;
+	view.positionBias = header.positionBias;
+	view.boundsCenter = header.boundsCenter;
+	view.boundsRadius = header.boundsRadius;
+	view.lodErrors.assign(header.lodErrors, header.lodErrors + header.lodCount);
+	view.vertexData = file.Data() + header.vertexDataOffset;
+	view.vertexCount = header.vertexCount;
+	view.vertexStride = header.vertexStride;
+	view.indexData = file.Data() + header.indexDataOffset;
+	view.indexCount = header.indexCount;
+	view.indexStride = header.indexStride;
+
+	//Submesh table
+	const char* cur = file.Data() + header.submeshTableOffset;
+	const char* tableEnd = file.Data() + header.vertexDataOffset;
+	view.submeshes.clear();
+	view.submeshes.reserve(header.submeshCount);
+	for (uint32_t i = 0; i < header.submeshCount; ++i)
+	{
+		SubmeshRecord record;
+		if (cur + sizeof(record) > tableEnd)
+			return miss();
+		memcpy(&record, cur, sizeof(record));
+		cur += sizeof(record);
+		if (cur + record.meshNameLength + record.materialNameLength > tableEnd)
+			return miss();
+		SubmeshGeometry submesh;
+		submesh.indexCount = record.indexCount;
+		submesh.startIndexLocation = record.startIndexLocation;
+		submesh.baseVertexLocation = record.baseVertexLocation;
+		submesh.firstMeshlet = record.firstMeshlet;
+		submesh.meshletCount = record.meshletCount;
+		submesh.lodLevel = record.lodLevel;
+		submesh.lodCount = record.lodCount;
+		submesh.aabb = record.aabb;
+		submesh.sphere = record.sphere;
+		submesh.meshName.assign(cur, record.meshNameLength);
+		cur += record.meshNameLength;
+		submesh.materialName.assign(cur, record.materialNameLength);
+		cur += record.materialNameLength;
+		view.submeshes.push_back(std::move(submesh));
+	}
+	view.meshlets.resize(header.meshletCount);
+	memcpy(view.meshlets.data(), file.Data() + header.meshletDataOffset, meshletBytes);
+	return true;
+}
+bool MeshCache::Save(const std::string& cacheFile, uint64_t sourceHash, const View& view)
+{
+	std::vector<char> table;
+	for (auto& submesh : view.submeshes)
+	{
+		SubmeshRecord record;
+		record.indexCount = submesh.indexCount;
+		record.startIndexLocation = submesh.startIndexLocation;
+		record.baseVertexLocation = submesh.baseVertexLocation;
+		record.firstMeshlet = submesh.firstMeshlet;
+		record.meshletCount = submesh.meshletCount;
+		record.lodLevel = submesh.lodLevel;
+		record.lodCount = submesh.lodCount;
+		record.aabb = submesh.aabb;
+		record.sphere = submesh.sphere;
+		record.meshNameLength = static_cast<uint16_t>(submesh.meshName.size());
+		record.materialNameLength = static_cast<uint16_t>(submesh.materialName.size());
+		const char* bytes = reinterpret_cast<const char*>(&record);
+		table.insert(table.end(), bytes, bytes + sizeof(record));
+		table.insert(table.end(), submesh.meshName.begin(), submesh.meshName.begin() + record.meshNameLength);
+		table.insert(table.end(), submesh.materialName.begin(), submesh.materialName.begin() + record.materialNameLength);
+	}
+
+	Header header = {};
+	header.magic = kMagic;
+	header.version = kVersion;
+	header.sourceHash = sourceHash;
+	header.vertexFormat = view.vertexFormat;
+	header.vertexStride = view.vertexStride;
+	header.vertexCount = view.vertexCount;
+	header.indexStride = view.indexStride;
+	header.indexCount = view.indexCount;
+	header.submeshCount = static_cast<uint32_t>(view.submeshes.size());
+	header.submeshTableOffset = sizeof(Header);
+	const uint64_t vertexBytes = uint64_t(view.vertexCount) * view.vertexStride;
+	const uint64_t indexBytes = uint64_t(view.indexCount) * view.indexStride;
+	header.vertexDataOffset = AlignUp(header.submeshTableOffset + table.size(), 16);
+	const uint64_t meshletBytes = uint64_t(view.meshlets.size()) * sizeof(Meshlet);
+	header.indexDataOffset = AlignUp(header.vertexDataOffset + vertexBytes, 16);
+	header.meshletDataOffset = AlignUp(header.indexDataOffset + indexBytes, 16);
+	header.meshletCount = static_cast<uint32_t>(view.meshlets.size());
+	header.positionScale = view.positionScale;
+	header.positionBias = view.positionBias;
+	header.boundsCenter = view.boundsCenter;
+	header.boundsRadius = view.boundsRadius;
+	header.lodCount = static_cast<uint32_t>((std::min)(view.lodErrors.size(), size_t(MeshSimplifier::kMaxLodLevels + 1)));
+	for (uint32_t i = 0; i < header.lodCount; ++i)
+		header.lodErrors[i] = view.lodErrors[i];
+
+	std::ofstream out(cacheFile, std::ios::binary | std::ios::trunc);
+	if (!out)
+		return false;
+	const char padding[16] = {};
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(table.data(), table.size());
+	out.write(padding, header.vertexDataOffset - (header.submeshTableOffset + table.size()));
+	out.write(static_cast<const char*>(view.vertexData), vertexBytes);
+	out.write(padding, header.indexDataOffset - (header.vertexDataOffset + vertexBytes));
+	out.write(static_cast<const char*>(view.indexData), indexBytes);
+	out.write(padding, header.meshletDataOffset - (header.indexDataOffset + indexBytes));
+	out.write(reinterpret_cast<const char*>(view.meshlets.data()), meshletBytes);
+	return out.good();
+}
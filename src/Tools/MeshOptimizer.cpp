@@ -0,0 +1,242 @@
+#include "Tools/MeshOptimizer.h"
+#include <algorithm>
+
+void MeshOptimizer::Optimize(GeometryGenerator::MeshData& meshData, bool overdraw)
+{
+	size_t vertexCount = meshData.vertices.size();
+	for (auto& group : meshData.idxGroups)
+	{
+		CacheStats before = AnalyzeVertexCache(group.indices, vertexCount, kCacheSize);
+		std::vector<uint32_t> clusters;
+		OptimizeVertexCache(group.indices, vertexCount, kCacheSize, &clusters);
+		if (overdraw)
+			OptimizeOverdraw(group.indices, clusters, meshData.vertices);
+		CacheStats after = AnalyzeVertexCache(group.indices, vertexCount, kCacheSize);
+
+		char text[256];
+		sprintf_s(text, "%s_%s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, %zu clusters\n",
+			meshData.name.c_str(), group.mtlName.c_str(), before.acmr, after.acmr, before.atvr, after.atvr, clusters.size());
+		OutputDebugStringA(text);
+	}
+	OptimizeVertexFetch(meshData);
+}
+void MeshOptimizer::OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, UINT cacheSize, std::vector<uint32_t>* clusters)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0)
+		return;
+
+	//Vertex -> triangle adjacency, liveCount is the number of triangles not emitted yet
+	std::vector<uint32_t> liveCount(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; ++i)
+	{
+		++liveCount[indices[i]];
+	}
+	std::vector<uint32_t> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		offsets[v + 1] = offsets[v] + liveCount[v];
+	}
+	std::vector<uint32_t> adjacency(offsets[vertexCount]);
+	std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		for (size_t k = 0; k < 3; ++k)
+			adjacency[fill[indices[t * 3 + k]]++] = static_cast<uint32_t>(t);
+	}
+
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	std::vector<bool> emitted(triangleCount, false);
+	std::vector<uint32_t> deadEnd;
+	std::vector<uint32_t> candidates;
+	std::vector<uint32_t> output;
+	output.reserve(triangleCount * 3);
+
+	uint32_t time = cacheSize + 1;
+	size_t cursor = 0;
+	int64_t fan = indices[0];
+	bool restart = true;
+	while (fan >= 0)
+	{
+		//Emit every remaining triangle around the fanning vertex
+		candidates.clear();
+		for (uint32_t a = offsets[fan]; a < offsets[fan + 1]; ++a)
+		{
+			uint32_t t = adjacency[a];
+			if (emitted[t])
+				continue;
+			if (restart && clusters != nullptr)
+				clusters->push_back(static_cast<uint32_t>(output.size() / 3));
+			restart = false;
+			for (size_t k = 0; k < 3; ++k)
+			{
+				uint32_t v = indices[t * 3 + k];
+				output.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				--liveCount[v];
+				if (time - cacheTime[v] > cacheSize)
+					cacheTime[v] = time++;
+			}
+			emitted[t] = true;
+		}
+
+		//Next fanning vertex: the 1-ring vertex that is still in the cache after its own triangles are emitted
+		int64_t best = -1;
+		int64_t bestPriority = -1;
+		for (uint32_t v : candidates)
+		{
+			if (liveCount[v] == 0)
+				continue;
+			int64_t priority = 0;
+			if (time - cacheTime[v] + 2 * liveCount[v] <= cacheSize)
+				priority = time - cacheTime[v];
+			if (priority > bestPriority)
+			{
+				best = v;
+				bestPriority = priority;
+			}
+		}
+		if (best < 0)
+		{
+			//Dead end: most recently referenced vertex with triangles left, otherwise input order
+			restart = true;
+			while (best < 0 && !deadEnd.empty())
+			{
+				uint32_t v = deadEnd.back();
+				deadEnd.pop_back();
+				if (liveCount[v] > 0)
+					best = v;
+			}
+			while (best < 0 && cursor < vertexCount)
+			{
+				if (liveCount[cursor] > 0)
+					best = cursor;
+				++cursor;
+			}
+		}
+		fan = best;
+	}
+	indices.swap(output);
+}
+void MeshOptimizer::OptimizeOverdraw(std::vector<uint32_t>& indices, const std::vector<uint32_t>& clusters, const std::vector<GeometryGenerator::Vertex>& vertices)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (clusters.size() < 2)
+		return;
+
+	struct Cluster
+	{
+		uint32_t firstTriangle;
+		uint32_t triangleCount;
+		float sortKey;
+	};
+	//Area weighted normal (unnormalized cross product) and centroid of a triangle
+	auto triangle = [&](size_t t, DirectX::XMVECTOR& centroid, DirectX::XMVECTOR& cross)
+	{
+		DirectX::XMVECTOR p0 = DirectX::XMLoadFloat3(&vertices[indices[t * 3 + 0]].position);
+		DirectX::XMVECTOR p1 = DirectX::XMLoadFloat3(&vertices[indices[t * 3 + 1]].position);
+		DirectX::XMVECTOR p2 = DirectX::XMLoadFloat3(&vertices[indices[t * 3 + 2]].position);
+		centroid = DirectX::XMVectorScale(DirectX::XMVectorAdd(DirectX::XMVectorAdd(p0, p1), p2), 1.0f / 3.0f);
+		cross = DirectX::XMVector3Cross(DirectX::XMVectorSubtract(p1, p0), DirectX::XMVectorSubtract(p2, p0));
+	};
+
+	DirectX::XMVECTOR meshCentroid = DirectX::XMVectorZero();
+	float meshArea = 0.0f;
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		DirectX::XMVECTOR centroid, cross;
+		triangle(t, centroid, cross);
+		float area = DirectX::XMVectorGetX(DirectX::XMVector3Length(cross));
+		meshCentroid = DirectX::XMVectorMultiplyAdd(centroid, DirectX::XMVectorReplicate(area), meshCentroid);
+		meshArea += area;
+	}
+	if (meshArea > 0.0f)
+		meshCentroid = DirectX::XMVectorScale(meshCentroid, 1.0f / meshArea);
+
+	//Clusters facing away from the mesh center occlude the rest, draw them first
+	std::vector<Cluster> ordered;
+	for (size_t c = 0; c < clusters.size(); ++c)
+	{
+		uint32_t first = clusters[c];
+		uint32_t last = c + 1 < clusters.size() ? clusters[c + 1] : static_cast<uint32_t>(triangleCount);
+		DirectX::XMVECTOR clusterCentroid = DirectX::XMVectorZero();
+		DirectX::XMVECTOR clusterNormal = DirectX::XMVectorZero();
+		float clusterArea = 0.0f;
+		for (uint32_t t = first; t < last; ++t)
+		{
+			DirectX::XMVECTOR centroid, cross;
+			triangle(t, centroid, cross);
+			float area = DirectX::XMVectorGetX(DirectX::XMVector3Length(cross));
+			clusterCentroid = DirectX::XMVectorMultiplyAdd(centroid, DirectX::XMVectorReplicate(area), clusterCentroid);
+			clusterNormal = DirectX::XMVectorAdd(clusterNormal, cross);
+			clusterArea += area;
+		}
+		if (clusterArea > 0.0f)
+			clusterCentroid = DirectX::XMVectorScale(clusterCentroid, 1.0f / clusterArea);
+		clusterNormal = DirectX::XMVector3Normalize(clusterNormal);
+		float key = DirectX::XMVectorGetX(DirectX::XMVector3Dot(DirectX::XMVectorSubtract(clusterCentroid, meshCentroid), clusterNormal));
+		ordered.push_back({ first, last - first, key });
+	}
+	std::stable_sort(ordered.begin(), ordered.end(), [](const Cluster& a, const Cluster& b) { return a.sortKey > b.sortKey; });
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	for (auto& cluster : ordered)
+	{
+		output.insert(output.end(), indices.begin() + cluster.firstTriangle * 3, indices.begin() + (cluster.firstTriangle + cluster.triangleCount) * 3);
+	}
+	indices.swap(output);
+}
+void MeshOptimizer::OptimizeVertexFetch(GeometryGenerator::MeshData& meshData)
+{
+	const uint32_t kUnused = 0xFFFFFFFF;
+	std::vector<uint32_t> remap(meshData.vertices.size(), kUnused);
+	std::vector<GeometryGenerator::Vertex> ordered;
+	ordered.reserve(meshData.vertices.size());
+	auto remapIndices = [&](std::vector<uint32_t>& indices)
+	{
+		for (auto& index : indices)
+		{
+			if (remap[index] == kUnused)
+			{
+				remap[index] = static_cast<uint32_t>(ordered.size());
+				ordered.push_back(meshData.vertices[index]);
+			}
+			index = remap[index];
+		}
+	};
+	for (auto& group : meshData.idxGroups)
+	{
+		remapIndices(group.indices);
+	}
+	remapIndices(meshData.indices);
+	//Unreferenced vertices are dropped
+	meshData.vertices.swap(ordered);
+}
+MeshOptimizer::CacheStats MeshOptimizer::AnalyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, UINT cacheSize)
+{
+	CacheStats stats;
+	if (indices.size() < 3)
+		return stats;
+	std::vector<uint32_t> cacheTime(vertexCount, 0);
+	std::vector<bool> referenced(vertexCount, false);
+	uint32_t time = cacheSize + 1;
+	size_t misses = 0, unique = 0;
+	for (uint32_t v : indices)
+	{
+		if (time - cacheTime[v] > cacheSize)
+		{
+			cacheTime[v] = time++;
+			++misses;
+		}
+		if (!referenced[v])
+		{
+			referenced[v] = true;
+			++unique;
+		}
+	}
+	stats.acmr = float(misses) / float(indices.size() / 3);
+	stats.atvr = float(misses) / float(unique);
+	return stats;
+}
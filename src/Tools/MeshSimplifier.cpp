@@ -0,0 +1,304 @@
+#include "Tools/MeshSimplifier.h"
+#include "Tools/MeshOptimizer.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	//Symmetric 4x4 matrix of the summed plane equations, weighted by triangle area
+	struct Quadric
+	{
+		double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+		double a11 = 0, a12 = 0, a13 = 0;
+		double a22 = 0, a23 = 0;
+		double a33 = 0;
+		double weight = 0;
+
+		void AddPlane(double a, double b, double c, double d, double w)
+		{
+			a00 += w * a * a; a01 += w * a * b; a02 += w * a * c; a03 += w * a * d;
+			a11 += w * b * b; a12 += w * b * c; a13 += w * b * d;
+			a22 += w * c * c; a23 += w * c * d;
+			a33 += w * d * d;
+			weight += w;
+		}
+		void Add(const Quadric& q)
+		{
+			a00 += q.a00; a01 += q.a01; a02 += q.a02; a03 += q.a03;
+			a11 += q.a11; a12 += q.a12; a13 += q.a13;
+			a22 += q.a22; a23 += q.a23;
+			a33 += q.a33;
+			weight += q.weight;
+		}
+		//Mean squared distance of p to the accumulated planes
+		double Error(const DirectX::XMFLOAT3& p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			double e = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+				+ a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+				+ a22 * z * z + 2 * a23 * z
+				+ a33;
+			return weight > 0 ? (e > 0 ? e : 0) / weight : 0;
+		}
+	};
+	struct Collapse
+	{
+		uint32_t from;
+		uint32_t to;
+		double cost;
+	};
+	DirectX::XMVECTOR TriangleNormal(DirectX::FXMVECTOR p0, DirectX::FXMVECTOR p1, DirectX::FXMVECTOR p2)
+	{
+		return DirectX::XMVector3Cross(DirectX::XMVectorSubtract(p1, p0), DirectX::XMVectorSubtract(p2, p0));
+	}
+}
+
+float MeshSimplifier::Simplify(const std::vector<GeometryGenerator::Vertex>& vertices, std::vector<uint32_t>& indices,
+	std::vector<uint32_t>& triangleGroups, size_t targetTriangleCount)
+{
+	size_t vertexCount = vertices.size();
+	size_t triangleCount = indices.size() / 3;
+
+	//Vertices sharing a position are one point of the surface, seams split it into several vertices
+	std::vector<uint32_t> positionId(vertexCount);
+	{
+		std::unordered_map<uint64_t, std::vector<uint32_t>> buckets;
+		for (uint32_t v = 0; v < vertexCount; ++v)
+		{
+			const DirectX::XMFLOAT3& p = vertices[v].position;
+			uint32_t bits[3];
+			memcpy(bits, &p, sizeof(bits));
+			uint64_t key = (uint64_t(bits[0]) * 0x9E3779B1u) ^ (uint64_t(bits[1]) << 21) ^ (uint64_t(bits[2]) * 0x85EBCA77ull << 7);
+			auto& bucket = buckets[key];
+			positionId[v] = v;
+			for (uint32_t other : bucket)
+			{
+				const DirectX::XMFLOAT3& q = vertices[other].position;
+				if (q.x == p.x && q.y == p.y && q.z == p.z)
+				{
+					positionId[v] = other;
+					break;
+				}
+			}
+			if (positionId[v] == v)
+				bucket.push_back(v);
+		}
+	}
+
+	//Locked positions: seams, material boundaries, borders
+	std::vector<bool> locked(vertexCount, false);
+	{
+		std::vector<uint32_t> firstVertex(vertexCount, UINT32_MAX);
+		std::vector<uint32_t> firstGroup(vertexCount, UINT32_MAX);
+		std::unordered_map<uint64_t, uint32_t> edgeUse;
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			for (size_t k = 0; k < 3; ++k)
+			{
+				uint32_t v = indices[t * 3 + k];
+				uint32_t pid = positionId[v];
+				if (firstVertex[pid] == UINT32_MAX)
+					firstVertex[pid] = v;
+				else if (firstVertex[pid] != v)
+					locked[pid] = true;
+				if (firstGroup[pid] == UINT32_MAX)
+					firstGroup[pid] = triangleGroups[t];
+				else if (firstGroup[pid] != triangleGroups[t])
+					locked[pid] = true;
+
+				uint32_t a = pid;
+				uint32_t b = positionId[indices[t * 3 + (k + 1) % 3]];
+				uint64_t key = a < b ? (uint64_t(a) << 32 | b) : (uint64_t(b) << 32 | a);
+				++edgeUse[key];
+			}
+		}
+		for (auto& edge : edgeUse)
+		{
+			if (edge.second == 1)
+			{
+				locked[edge.first >> 32] = true;
+				locked[edge.first & 0xFFFFFFFF] = true;
+			}
+		}
+	}
+
+	//Plane quadrics per position
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		DirectX::XMVECTOR p0 = DirectX::XMLoadFloat3(&vertices[indices[t * 3 + 0]].position);
+		DirectX::XMVECTOR p1 = DirectX::XMLoadFloat3(&vertices[indices[t * 3 + 1]].position);
+		DirectX::XMVECTOR p2 = DirectX::XMLoadFloat3(&vertices[indices[t * 3 + 2]].position);
+		DirectX::XMVECTOR normal = TriangleNormal(p0, p1, p2);
+		float area = DirectX::XMVectorGetX(DirectX::XMVector3Length(normal));
+		if (area <= 0.0f)
+			continue;
+		DirectX::XMFLOAT3 n;
+		DirectX::XMStoreFloat3(&n, DirectX::XMVectorScale(normal, 1.0f / area));
+		double d = -DirectX::XMVectorGetX(DirectX::XMVector3Dot(DirectX::XMLoadFloat3(&n), p0));
+		Quadric plane;
+		plane.AddPlane(n.x, n.y, n.z, d, area);
+		for (size_t k = 0; k < 3; ++k)
+			quadrics[positionId[indices[t * 3 + k]]].Add(plane);
+	}
+
+	double maxError = 0.0;
+	std::vector<uint32_t> offsets(vertexCount + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<Collapse> collapses;
+	std::vector<uint32_t> remap(vertexCount);
+	std::vector<bool> touched(vertexCount);
+	while (triangleCount > targetTriangleCount)
+	{
+		//Vertex -> triangle adjacency of the current mesh
+		std::fill(offsets.begin(), offsets.end(), 0);
+		for (uint32_t index : indices)
+			++offsets[index + 1];
+		for (size_t v = 0; v < vertexCount; ++v)
+			offsets[v + 1] += offsets[v];
+		adjacency.resize(indices.size());
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < indices.size(); ++i)
+			adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+
+		//Every edge in both directions, the moving end must be free
+		collapses.clear();
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			for (size_t k = 0; k < 3; ++k)
+			{
+				uint32_t a = indices[t * 3 + k];
+				uint32_t b = indices[t * 3 + (k + 1) % 3];
+				Quadric q = quadrics[positionId[a]];
+				q.Add(quadrics[positionId[b]]);
+				if (!locked[positionId[a]])
+					collapses.push_back({ a, b, q.Error(vertices[b].position) });
+				if (!locked[positionId[b]])
+					collapses.push_back({ b, a, q.Error(vertices[a].position) });
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+		for (uint32_t v = 0; v < vertexCount; ++v)
+			remap[v] = v;
+		std::fill(touched.begin(), touched.end(), false);
+		size_t removed = 0;
+		size_t performed = 0;
+		for (auto& collapse : collapses)
+		{
+			if (triangleCount - removed <= targetTriangleCount)
+				break;
+			uint32_t from = collapse.from, to = collapse.to;
+			if (touched[from] || touched[to])
+				continue;
+
+			//Reject collapses that flip or squash a remaining triangle
+			bool valid = true;
+			size_t lost = 0;
+			DirectX::XMVECTOR target = DirectX::XMLoadFloat3(&vertices[to].position);
+			for (uint32_t a = offsets[from]; a < offsets[from + 1] && valid; ++a)
+			{
+				uint32_t t = adjacency[a];
+				uint32_t i0 = indices[t * 3 + 0], i1 = indices[t * 3 + 1], i2 = indices[t * 3 + 2];
+				if (i0 == to || i1 == to || i2 == to)
+				{
+					++lost;
+					continue;
+				}
+				DirectX::XMVECTOR p[3] = {
+					DirectX::XMLoadFloat3(&vertices[i0].position),
+					DirectX::XMLoadFloat3(&vertices[i1].position),
+					DirectX::XMLoadFloat3(&vertices[i2].position) };
+				DirectX::XMVECTOR before = TriangleNormal(p[0], p[1], p[2]);
+				p[i0 == from ? 0 : (i1 == from ? 1 : 2)] = target;
+				DirectX::XMVECTOR after = TriangleNormal(p[0], p[1], p[2]);
+				float dot = DirectX::XMVectorGetX(DirectX::XMVector3Dot(before, after));
+				float lengths = DirectX::XMVectorGetX(DirectX::XMVector3Length(before)) * DirectX::XMVectorGetX(DirectX::XMVector3Length(after));
+				if (dot <= 0.25f * lengths)
+					valid = false;
+			}
+			if (!valid || lost == 0)
+				continue;
+
+			remap[from] = to;
+			quadrics[positionId[to]].Add(quadrics[positionId[from]]);
+			maxError = (std::max)(maxError, collapse.cost);
+			removed += lost;
+			++performed;
+			//Neighbours keep their positions for the rest of the pass so the flip test above stays valid
+			for (uint32_t a = offsets[from]; a < offsets[from + 1]; ++a)
+			{
+				uint32_t t = adjacency[a];
+				for (size_t k = 0; k < 3; ++k)
+					touched[indices[t * 3 + k]] = true;
+			}
+		}
+		if (performed == 0)
+			break;
+
+		//Apply and drop collapsed triangles
+		size_t write = 0;
+		for (size_t t = 0; t < triangleCount; ++t)
+		{
+			uint32_t i0 = remap[indices[t * 3 + 0]], i1 = remap[indices[t * 3 + 1]], i2 = remap[indices[t * 3 + 2]];
+			if (i0 == i1 || i1 == i2 || i0 == i2)
+				continue;
+			indices[write * 3 + 0] = i0;
+			indices[write * 3 + 1] = i1;
+			indices[write * 3 + 2] = i2;
+			triangleGroups[write] = triangleGroups[t];
+			++write;
+		}
+		triangleCount = write;
+		indices.resize(triangleCount * 3);
+		triangleGroups.resize(triangleCount);
+	}
+	return static_cast<float>(std::sqrt(maxError));
+}
+void MeshSimplifier::GenerateLods(GeometryGenerator::MeshData& meshData, UINT levelCount)
+{
+	//All groups at once, they share vertices and their boundaries must stay in place
+	std::vector<uint32_t> indices;
+	std::vector<uint32_t> triangleGroups;
+	for (uint32_t g = 0; g < meshData.idxGroups.size(); ++g)
+	{
+		auto& groupIndices = meshData.idxGroups[g].indices;
+		size_t count = groupIndices.size() - groupIndices.size() % 3;
+		indices.insert(indices.end(), groupIndices.begin(), groupIndices.begin() + count);
+		triangleGroups.insert(triangleGroups.end(), count / 3, g);
+	}
+
+	//Too small to be worth a level
+	const size_t kMinTriangles = 64;
+	float error = 0.0f;
+	for (UINT level = 0; level < levelCount; ++level)
+	{
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount < kMinTriangles * 2)
+			break;
+		//Each level is measured against the one before it, summing the steps bounds the distance to level 0
+		float levelError = Simplify(meshData.vertices, indices, triangleGroups, triangleCount / 2);
+		error += levelError;
+		//Locked vertices stop the reduction, an almost identical level is useless
+		if (indices.size() / 3 > triangleCount * 9 / 10)
+			break;
+
+		GeometryGenerator::MeshData::LodLevel lod;
+		lod.error = error;
+		lod.idxGroups.resize(meshData.idxGroups.size());
+		for (size_t g = 0; g < meshData.idxGroups.size(); ++g)
+		{
+			lod.idxGroups[g].mtlName = meshData.idxGroups[g].mtlName;
+		}
+		for (size_t t = 0; t < triangleGroups.size(); ++t)
+		{
+			auto& groupIndices = lod.idxGroups[triangleGroups[t]].indices;
+			groupIndices.insert(groupIndices.end(), indices.begin() + t * 3, indices.begin() + t * 3 + 3);
+		}
+		for (auto& group : lod.idxGroups)
+		{
+			MeshOptimizer::OptimizeVertexCache(group.indices, meshData.vertices.size(), MeshOptimizer::kCacheSize);
+		}
+		meshData.lods.push_back(std::move(lod));
+	}
+}
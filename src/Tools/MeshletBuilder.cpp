@@ -0,0 +1,146 @@
+#include "Tools/MeshletBuilder.h"
+#include <cmath>
+
+using namespace DirectX;
+
+void MeshletBuilder::Build(const std::vector<GeometryGenerator::Vertex>& vertices, const uint32_t* indices, size_t indexCount,
+	UINT startIndexLocation, std::vector<Meshlet>& meshlets)
+{
+	//stamp[v] == meshletNumber when v is already part of the current meshlet
+	std::vector<uint32_t> stamp(vertices.size(), 0);
+	std::vector<uint32_t> unique;
+	std::vector<XMVECTOR> normals;
+	uint32_t meshletNumber = 1;
+	size_t first = 0;
+
+	auto flush = [&](size_t end)
+	{
+		if (end == first)
+			return;
+		Meshlet meshlet;
+		meshlet.startIndexLocation = startIndexLocation + static_cast<UINT>(first);
+		meshlet.indexCount = static_cast<UINT>(end - first);
+		meshlet.vertexCount = static_cast<UINT>(unique.size());
+
+		//Sphere around the box center
+		XMVECTOR minimum = XMLoadFloat3(&vertices[unique[0]].position);
+		XMVECTOR maximum = minimum;
+		for (uint32_t v : unique)
+		{
+			XMVECTOR p = XMLoadFloat3(&vertices[v].position);
+			minimum = XMVectorMin(minimum, p);
+			maximum = XMVectorMax(maximum, p);
+		}
+		XMVECTOR center = XMVectorScale(XMVectorAdd(minimum, maximum), 0.5f);
+		float radius = 0.0f;
+		for (uint32_t v : unique)
+		{
+			float distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&vertices[v].position), center)));
+			radius = distance > radius ? distance : radius;
+		}
+		XMStoreFloat3(&meshlet.center, center);
+		meshlet.radius = radius;
+
+		//Cone axis is the average face normal, the cutoff comes from the widest normal around it
+		normals.clear();
+		XMVECTOR axis = XMVectorZero();
+		for (size_t i = first; i < end; i += 3)
+		{
+			XMVECTOR p0 = XMLoadFloat3(&vertices[indices[i + 0]].position);
+			XMVECTOR p1 = XMLoadFloat3(&vertices[indices[i + 1]].position);
+			XMVECTOR p2 = XMLoadFloat3(&vertices[indices[i + 2]].position);
+			XMVECTOR normal = XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0));
+			if (XMVectorGetX(XMVector3LengthSq(normal)) <= 0.0f)
+				continue;
+			normal = XMVector3Normalize(normal);
+			normals.push_back(normal);
+			axis = XMVectorAdd(axis, normal);
+		}
+		meshlet.coneAxis = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		meshlet.coneCutoff = 1.0f;
+		if (!normals.empty() && XMVectorGetX(XMVector3LengthSq(axis)) > 0.0f)
+		{
+			axis = XMVector3Normalize(axis);
+			float minDot = 1.0f;
+			for (auto& normal : normals)
+			{
+				float d = XMVectorGetX(XMVector3Dot(normal, axis));
+				minDot = d < minDot ? d : minDot;
+			}
+			XMStoreFloat3(&meshlet.coneAxis, axis);
+			//Wider than a hemisphere, no viewpoint sees only back faces
+			if (minDot > 0.0f)
+				meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+		}
+		meshlets.push_back(meshlet);
+	};
+
+	for (size_t i = 0; i + 2 < indexCount; i += 3)
+	{
+		UINT newVertices = 0;
+		for (size_t k = 0; k < 3; ++k)
+		{
+			if (stamp[indices[i + k]] != meshletNumber)
+				++newVertices;
+		}
+		//A repeated index in a degenerate triangle is counted twice, which only makes the limit conservative
+		if (unique.size() + newVertices > kMaxVertices || (i - first) / 3 >= kMaxTriangles)
+		{
+			flush(i);
+			unique.clear();
+			++meshletNumber;
+			first = i;
+		}
+		for (size_t k = 0; k < 3; ++k)
+		{
+			uint32_t v = indices[i + k];
+			if (stamp[v] != meshletNumber)
+			{
+				stamp[v] = meshletNumber;
+				unique.push_back(v);
+			}
+		}
+	}
+	flush(indexCount - indexCount % 3);
+}
+size_t MeshletBuilder::Cull(const Meshlet* meshlets, size_t meshletCount, FXMMATRIX world,
+	const BoundingFrustum& frustum, FXMVECTOR eyePos, std::vector<IndexRange>& ranges)
+{
+	ranges.clear();
+	//Largest axis scale keeps the spheres conservative under non-uniform scaling
+	float scale = XMVectorGetX(XMVector3LengthSq(world.r[0]));
+	scale = (std::fmax)(scale, XMVectorGetX(XMVector3LengthSq(world.r[1])));
+	scale = (std::fmax)(scale, XMVectorGetX(XMVector3LengthSq(world.r[2])));
+	scale = std::sqrt(scale);
+
+	size_t culled = 0;
+	for (size_t i = 0; i < meshletCount; ++i)
+	{
+		const Meshlet& meshlet = meshlets[i];
+		XMVECTOR center = XMVector3TransformCoord(XMLoadFloat3(&meshlet.center), world);
+		BoundingSphere sphere;
+		XMStoreFloat3(&sphere.Center, center);
+		sphere.Radius = meshlet.radius * scale;
+
+		bool visible = frustum.Intersects(sphere);
+		if (visible && meshlet.coneCutoff < 1.0f)
+		{
+			XMVECTOR axis = XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&meshlet.coneAxis), world));
+			XMVECTOR toCenter = XMVectorSubtract(center, eyePos);
+			float d = XMVectorGetX(XMVector3Dot(toCenter, axis));
+			float distance = XMVectorGetX(XMVector3Length(toCenter));
+			if (d >= meshlet.coneCutoff * distance + sphere.Radius)
+				visible = false;
+		}
+		if (!visible)
+		{
+			++culled;
+			continue;
+		}
+		if (!ranges.empty() && ranges.back().startIndexLocation + ranges.back().indexCount == meshlet.startIndexLocation)
+			ranges.back().indexCount += meshlet.indexCount;
+		else
+			ranges.push_back({ meshlet.startIndexLocation, meshlet.indexCount });
+	}
+	return culled;
+}
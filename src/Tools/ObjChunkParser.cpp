@@ -0,0 +1,145 @@
+#include "Tools/ObjChunkParser.h"
+#include "Tools/ObjTokenizer.h"
+#include "Tools/JobSystem.h"
+#include <thread>
+
+std::vector<const char*> ObjChunkParser::SplitOnLines(const char* begin, const char* end, size_t rangeCount)
+{
+	//rangeCount + 1 boundaries, every inner boundary moved forward to the start of a line
+	std::vector<const char*> bounds;
+	bounds.push_back(begin);
+	size_t size = end - begin;
+	for (size_t i = 1; i < rangeCount; ++i)
+	{
+		const char* split = begin + size * i / rangeCount;
+		if (split < bounds.back())
+			split = bounds.back();
+		const char* newLine = static_cast<const char*>(memchr(split, '\n', end - split));
+		split = newLine != nullptr ? newLine + 1 : end;
+		if (split > bounds.back() && split < end)
+			bounds.push_back(split);
+	}
+	bounds.push_back(end);
+	return bounds;
+}
+void ObjChunkParser::Parse(const char* begin, const char* end, std::vector<ObjChunk>& chunks, JobSystem* jobs)
+{
+	size_t size = end - begin;
+	size_t rangeCount = size / kMinChunkBytes;
+	size_t threadCount = jobs ? jobs->WorkerCount() + 1 : std::thread::hardware_concurrency();
+	if (rangeCount > threadCount)
+		rangeCount = threadCount;
+	if (rangeCount == 0)
+		rangeCount = 1;
+
+	std::vector<const char*> bounds = SplitOnLines(begin, end, rangeCount);
+	chunks.clear();
+	chunks.resize(bounds.size() - 1);
+	if (jobs)
+	{
+		jobs->ParallelFor(chunks.size(), 1, [&](size_t first, size_t last)
+		{
+			for (size_t i = first; i < last; ++i)
+			{
+				ParseRange(bounds[i], bounds[i + 1], chunks[i]);
+			}
+		});
+		return;
+	}
+
+	//First range on the calling thread, the rest on workers
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < chunks.size(); ++i)
+	{
+		workers.emplace_back(ParseRange, bounds[i], bounds[i + 1], std::ref(chunks[i]));
+	}
+	ParseRange(bounds[0], bounds[1], chunks[0]);
+	for (auto& worker : workers)
+	{
+		worker.join();
+	}
+}
+void ObjChunkParser::ParseRange(const char* begin, const char* end, ObjChunk& chunk)
+{
+	//Rough reservation, a typical "v" line is around 30 bytes
+	size_t estimate = (end - begin) / 128;
+	chunk.positions.reserve(estimate);
+	chunk.texCoords.reserve(estimate);
+	chunk.normals.reserve(estimate);
+	chunk.corners.reserve(estimate * 3);
+
+	//Relative indices point backwards from the current list end. Rebase them to the chunk start.
+	auto rebase = [](int index, size_t localCount)
+	{
+		return index < 0 ? static_cast<int>(localCount) + index + kChunkRelativeBias : index;
+	};
+
+	ObjTokenizer tokenizer(begin, end);
+	ObjLine line;
+	while (tokenizer.NextLine(line))
+	{
+		std::string_view keyword = line.NextToken();
+		if (keyword.empty())
+			continue;
+		if (keyword == "v")
+		{
+			DirectX::XMFLOAT3 position(0.0f, 0.0f, 0.0f);
+			line.NextFloat(position.x);
+			line.NextFloat(position.y);
+			line.NextFloat(position.z);
+			chunk.positions.push_back(position);
+		}
+		else if (keyword == "vt")
+		{
+			DirectX::XMFLOAT2 tex(0.0f, 0.0f);
+			line.NextFloat(tex.x);
+			line.NextFloat(tex.y);
+			chunk.texCoords.push_back(tex);
+		}
+		else if (keyword == "vn")
+		{
+			DirectX::XMFLOAT3 normal(0.0f, 0.0f, 0.0f);
+			line.NextFloat(normal.x);
+			line.NextFloat(normal.y);
+			line.NextFloat(normal.z);
+			chunk.normals.push_back(normal);
+		}
+		else if (keyword == "f")
+		{
+			//Polygons are triangulated as a fan around the first corner
+			ObjCorner first = {}, previous = {}, corner;
+			int cornerCount = 0;
+			while (line.NextFaceCorner(corner.v, corner.vt, corner.vn))
+			{
+				corner.v = rebase(corner.v, chunk.positions.size());
+				corner.vt = rebase(corner.vt, chunk.texCoords.size());
+				corner.vn = rebase(corner.vn, chunk.normals.size());
+				if (cornerCount >= 3)
+				{
+					chunk.corners.push_back(first);
+					chunk.corners.push_back(previous);
+				}
+				chunk.corners.push_back(corner);
+				if (cornerCount == 0)
+					first = corner;
+				previous = corner;
+				++cornerCount;
+			}
+		}
+		else if (keyword == "g")
+		{
+			std::string_view name = line.NextToken();
+			if (name == "group")
+				name = line.NextToken();
+			chunk.statements.push_back({ ObjStatement::Group, chunk.corners.size(), std::string(name) });
+		}
+		else if (keyword == "usemtl")
+		{
+			chunk.statements.push_back({ ObjStatement::UseMtl, chunk.corners.size(), std::string(line.NextToken()) });
+		}
+		else if (keyword == "mtllib")
+		{
+			chunk.statements.push_back({ ObjStatement::MtlLib, chunk.corners.size(), std::string(line.Rest()) });
+		}
+	}
+}
@@ -0,0 +1,206 @@
+#include "Tools/OcclusionBuffer.h"
+
+using namespace DirectX;
+
+namespace
+{
+	//Closer than this in w counts as touching the near plane
+	const float kMinW = 1e-4f;
+}
+
+OcclusionBuffer::OcclusionBuffer() :
+	mDepth(kWidth * kHeight, 1.0f),
+	mTileMaxDepth(kTilesX * kTilesY, 1.0f)
+{
+	XMStoreFloat4x4(&mViewProj, XMMatrixIdentity());
+}
+void OcclusionBuffer::Render(const std::vector<Occluder>& occluders, FXMMATRIX viewProj, JobSystem& jobs)
+{
+	XMStoreFloat4x4(&mViewProj, viewProj);
+
+	//Triangle setup on the calling thread, the bands only read the result
+	mTriangles.clear();
+	for (auto& occluder : occluders)
+	{
+		XMMATRIX worldViewProj = XMMatrixMultiply(XMLoadFloat4x4(&occluder.world), viewProj);
+		for (size_t i = 0; i + 2 < occluder.indexCount; i += 3)
+		{
+			Triangle triangle;
+			bool skip = false;
+			for (size_t k = 0; k < 3; ++k)
+			{
+				XMFLOAT4 p;
+				XMStoreFloat4(&p, XMVector3Transform(XMLoadFloat3(&occluder.positions[occluder.indices[i + k]]), worldViewProj));
+				//In front of the near plane
+				if (p.w < kMinW || p.z < 0.0f)
+				{
+					skip = true;
+					break;
+				}
+				float invW = 1.0f / p.w;
+				triangle.x[k] = (p.x * invW * 0.5f + 0.5f) * kWidth;
+				triangle.y[k] = (0.5f - p.y * invW * 0.5f) * kHeight;
+				triangle.z[k] = p.z * invW;
+			}
+			if (skip)
+				continue;
+
+			//Pixel y grows downwards, swapping two vertices makes every triangle counter-clockwise
+			float area = (triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0]) - (triangle.y[1] - triangle.y[0]) * (triangle.x[2] - triangle.x[0]);
+			if (area == 0.0f)
+				continue;
+			if (area < 0.0f)
+			{
+				std::swap(triangle.x[1], triangle.x[2]);
+				std::swap(triangle.y[1], triangle.y[2]);
+				std::swap(triangle.z[1], triangle.z[2]);
+				area = -area;
+			}
+			triangle.invArea = 1.0f / area;
+			float minX = (std::min)(triangle.x[0], (std::min)(triangle.x[1], triangle.x[2]));
+			float maxX = (std::max)(triangle.x[0], (std::max)(triangle.x[1], triangle.x[2]));
+			float minY = (std::min)(triangle.y[0], (std::min)(triangle.y[1], triangle.y[2]));
+			float maxY = (std::max)(triangle.y[0], (std::max)(triangle.y[1], triangle.y[2]));
+			if (maxX < 0.0f || maxY < 0.0f || minX >= kWidth || minY >= kHeight)
+				continue;
+			//Clamped as floats, vertices far off screen do not fit an int
+			triangle.minX = static_cast<int>((std::max)(minX, 0.0f));
+			triangle.maxX = static_cast<int>((std::min)(maxX, kWidth - 1.0f));
+			triangle.minY = static_cast<int>((std::max)(minY, 0.0f));
+			triangle.maxY = static_cast<int>((std::min)(maxY, kHeight - 1.0f));
+			mTriangles.push_back(triangle);
+		}
+	}
+
+	//Bands own disjoint rows, no synchronization besides the final wait
+	jobs.ParallelFor(kBands, 1, [this](size_t begin, size_t end)
+	{
+		for (size_t band = begin; band < end; ++band)
+		{
+			RasterizeBand(static_cast<UINT>(band));
+			BuildTiles(static_cast<UINT>(band));
+		}
+	});
+}
+void OcclusionBuffer::RasterizeBand(UINT band)
+{
+	const int bandHeight = kHeight / kBands;
+	const int bandMinY = band * bandHeight;
+	const int bandMaxY = bandMinY + bandHeight - 1;
+	std::fill(mDepth.begin() + bandMinY * kWidth, mDepth.begin() + (bandMaxY + 1) * kWidth, 1.0f);
+
+	const XMVECTOR laneOffsets = XMVectorSet(0.5f, 1.5f, 2.5f, 3.5f);
+	const XMVECTOR zero = XMVectorZero();
+	for (auto& triangle : mTriangles)
+	{
+		int minY = (std::max)(triangle.minY, bandMinY);
+		int maxY = (std::min)(triangle.maxY, bandMaxY);
+		if (minY > maxY)
+			continue;
+
+		//Edge functions e(p) = a * p.x + b * p.y + c, edge k is opposite vertex k
+		XMVECTOR a[3], b[3], c[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			int from = (k + 1) % 3, to = (k + 2) % 3;
+			float ea = triangle.y[from] - triangle.y[to];
+			float eb = triangle.x[to] - triangle.x[from];
+			float ec = -(ea * triangle.x[from] + eb * triangle.y[from]);
+			a[k] = XMVectorReplicate(ea);
+			b[k] = XMVectorReplicate(eb);
+			c[k] = XMVectorReplicate(ec);
+		}
+		//Barycentric weights times the vertex depths, divided by the area once
+		XMVECTOR z[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			z[k] = XMVectorReplicate(triangle.z[k] * triangle.invArea);
+		}
+
+		int startX = triangle.minX & ~3;
+		for (int y = minY; y <= maxY; ++y)
+		{
+			XMVECTOR py = XMVectorReplicate(y + 0.5f);
+			XMVECTOR rowStart[3];
+			for (int k = 0; k < 3; ++k)
+			{
+				rowStart[k] = XMVectorMultiplyAdd(b[k], py, c[k]);
+			}
+			float* row = &mDepth[y * kWidth];
+			for (int x = startX; x <= triangle.maxX; x += 4)
+			{
+				XMVECTOR px = XMVectorAdd(XMVectorReplicate(static_cast<float>(x)), laneOffsets);
+				XMVECTOR e0 = XMVectorMultiplyAdd(a[0], px, rowStart[0]);
+				XMVECTOR e1 = XMVectorMultiplyAdd(a[1], px, rowStart[1]);
+				XMVECTOR e2 = XMVectorMultiplyAdd(a[2], px, rowStart[2]);
+				XMVECTOR inside = XMVectorAndInt(XMVectorGreaterOrEqual(e0, zero),
+					XMVectorAndInt(XMVectorGreaterOrEqual(e1, zero), XMVectorGreaterOrEqual(e2, zero)));
+				XMVECTOR depth = XMVectorMultiply(e0, z[0]);
+				depth = XMVectorMultiplyAdd(e1, z[1], depth);
+				depth = XMVectorMultiplyAdd(e2, z[2], depth);
+
+				XMFLOAT4* pixels = reinterpret_cast<XMFLOAT4*>(row + x);
+				XMVECTOR current = XMLoadFloat4(pixels);
+				XMStoreFloat4(pixels, XMVectorSelect(current, XMVectorMin(current, depth), inside));
+			}
+		}
+	}
+}
+void OcclusionBuffer::BuildTiles(UINT band)
+{
+	const UINT tileRows = kTilesY / kBands;
+	for (UINT tileY = band * tileRows; tileY < (band + 1) * tileRows; ++tileY)
+	{
+		for (UINT tileX = 0; tileX < kTilesX; ++tileX)
+		{
+			XMVECTOR maximum = XMVectorZero();
+			for (UINT y = tileY * kTileSize; y < (tileY + 1) * kTileSize; ++y)
+			{
+				const float* row = &mDepth[y * kWidth + tileX * kTileSize];
+				maximum = XMVectorMax(maximum, XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(row)));
+				maximum = XMVectorMax(maximum, XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(row + 4)));
+			}
+			XMFLOAT4 lanes;
+			XMStoreFloat4(&lanes, maximum);
+			mTileMaxDepth[tileY * kTilesX + tileX] = (std::max)((std::max)(lanes.x, lanes.y), (std::max)(lanes.z, lanes.w));
+		}
+	}
+}
+bool OcclusionBuffer::IsVisible(const BoundingBox& aabb) const
+{
+	XMMATRIX viewProj = XMLoadFloat4x4(&mViewProj);
+	XMFLOAT3 cornerPoints[BoundingBox::CORNER_COUNT];
+	aabb.GetCorners(cornerPoints);
+	float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+	for (auto& corner : cornerPoints)
+	{
+		XMFLOAT4 p;
+		XMStoreFloat4(&p, XMVector3Transform(XMLoadFloat3(&corner), viewProj));
+		if (p.w < kMinW)
+			return true;
+		float invW = 1.0f / p.w;
+		float x = (p.x * invW * 0.5f + 0.5f) * kWidth;
+		float y = (0.5f - p.y * invW * 0.5f) * kHeight;
+		minX = (std::min)(minX, x);
+		maxX = (std::max)(maxX, x);
+		minY = (std::min)(minY, y);
+		maxY = (std::max)(maxY, y);
+		minZ = (std::min)(minZ, p.z * invW);
+	}
+	if (maxX < 0.0f || maxY < 0.0f || minX >= kWidth || minY >= kHeight)
+		return false;
+
+	UINT tileMinX = static_cast<UINT>((std::max)(minX, 0.0f)) / kTileSize;
+	UINT tileMaxX = static_cast<UINT>((std::min)(maxX, kWidth - 1.0f)) / kTileSize;
+	UINT tileMinY = static_cast<UINT>((std::max)(minY, 0.0f)) / kTileSize;
+	UINT tileMaxY = static_cast<UINT>((std::min)(maxY, kHeight - 1.0f)) / kTileSize;
+	for (UINT tileY = tileMinY; tileY <= tileMaxY; ++tileY)
+	{
+		for (UINT tileX = tileMinX; tileX <= tileMaxX; ++tileX)
+		{
+			if (minZ <= mTileMaxDepth[tileY * kTilesX + tileX])
+				return true;
+		}
+	}
+	return false;
+}
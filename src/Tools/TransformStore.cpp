@@ -0,0 +1,99 @@
+#include "Tools/TransformStore.h"
+
+using namespace DirectX;
+
+UINT TransformStore::Add(UINT parent)
+{
+	XMFLOAT4X4 identity;
+	XMStoreFloat4x4(&identity, XMMatrixIdentity());
+	mScaling.push_back(identity);
+	mMotion.push_back(identity);
+	mWorld.push_back(identity);
+	mParent.push_back(parent);
+	//Picks up the world of the parent on the next update
+	mDirty.push_back(parent != kNoParent ? 1 : 0);
+	mChanged.push_back(0);
+	mOrderDirty = true;
+	return static_cast<UINT>(mWorld.size() - 1);
+}
+bool TransformStore::SetParent(UINT index, UINT parent)
+{
+	for (UINT ancestor = parent; ancestor != kNoParent; ancestor = mParent[ancestor])
+	{
+		if (ancestor == index)
+			return false;
+	}
+	mParent[index] = parent;
+	mDirty[index] = 1;
+	mOrderDirty = true;
+	return true;
+}
+void TransformStore::Move(UINT index, FXMMATRIX scaling, CXMMATRIX rotation, CXMMATRIX translation)
+{
+	XMStoreFloat4x4(&mScaling[index], XMMatrixMultiply(scaling, XMLoadFloat4x4(&mScaling[index])));
+	XMStoreFloat4x4(&mMotion[index], XMMatrixMultiply(rotation, translation));
+	mDirty[index] = 1;
+}
+void TransformStore::BuildOrder()
+{
+	const UINT count = static_cast<UINT>(mWorld.size());
+	//Children of every transform in index order, counting sort on the parent
+	std::vector<UINT> childStart(count + 1, 0);
+	for (UINT i = 0; i < count; ++i)
+	{
+		if (mParent[i] != kNoParent)
+			++childStart[mParent[i] + 1];
+	}
+	for (UINT i = 0; i < count; ++i)
+	{
+		childStart[i + 1] += childStart[i];
+	}
+	std::vector<UINT> children(childStart[count]);
+	std::vector<UINT> cursor(childStart.begin(), childStart.end() - 1);
+	for (UINT i = 0; i < count; ++i)
+	{
+		if (mParent[i] != kNoParent)
+			children[cursor[mParent[i]]++] = i;
+	}
+
+	mOrder.clear();
+	std::vector<UINT> stack;
+	for (UINT root = 0; root < count; ++root)
+	{
+		if (mParent[root] != kNoParent)
+			continue;
+		stack.push_back(root);
+		while (!stack.empty())
+		{
+			UINT node = stack.back();
+			stack.pop_back();
+			mOrder.push_back(node);
+			//Reversed so the first child is visited first
+			for (UINT c = childStart[node + 1]; c > childStart[node]; --c)
+			{
+				stack.push_back(children[c - 1]);
+			}
+		}
+	}
+	mOrderDirty = false;
+}
+void TransformStore::Update(std::vector<UINT>& updated)
+{
+	if (mOrderDirty)
+		BuildOrder();
+	//Parents come first, so their changed flag is final when the children read it
+	for (UINT i : mOrder)
+	{
+		UINT parent = mParent[i];
+		bool changed = mDirty[i] || (parent != kNoParent && mChanged[parent]);
+		mChanged[i] = changed ? 1 : 0;
+		if (!changed)
+			continue;
+		XMMATRIX world = XMMatrixMultiply(XMLoadFloat4x4(&mScaling[i]), XMLoadFloat4x4(&mMotion[i]));
+		if (parent != kNoParent)
+			world = XMMatrixMultiply(world, XMLoadFloat4x4(&mWorld[parent]));
+		XMStoreFloat4x4(&mWorld[i], world);
+		mDirty[i] = 0;
+		updated.push_back(i);
+	}
+}
@@ -0,0 +1,94 @@
+#include "Tools/VertexWeldTable.h"
+
+size_t VertexWeldTable::Hash(int v, int vt, int vn)
+{
+	//All three indices take part, multiply-xorshift so nearby triples spread over the table
+	uint64_t h = uint32_t(v) * 0x9E3779B97F4A7C15ull;
+	h ^= uint32_t(vt) * 0xC2B2AE3D27D4EB4Full + (h >> 29);
+	h ^= uint32_t(vn) * 0x165667B19E3779F9ull + (h >> 32);
+	h ^= h >> 31;
+	h *= 0xD6E8FEB86659FD93ull;
+	h ^= h >> 32;
+	return static_cast<size_t>(h);
+}
+void VertexWeldTable::Rehash(size_t slotCount)
+{
+	std::vector<Slot> old = std::move(mSlots);
+	mSlots.assign(slotCount, Slot{ 0, 0, 0, kEmpty });
+	mMask = slotCount - 1;
+	mUsedSlots.clear();
+	for (auto& slot : old)
+	{
+		if (slot.index == kEmpty)
+			continue;
+		size_t i = Hash(slot.v, slot.vt, slot.vn) & mMask;
+		while (mSlots[i].index != kEmpty)
+			i = (i + 1) & mMask;
+		mSlots[i] = slot;
+		mUsedSlots.push_back(i);
+	}
+}
+void VertexWeldTable::Reset(size_t expectedVertices)
+{
+	size_t slotCount = 64;
+	while (slotCount < expectedVertices * 2)
+		slotCount <<= 1;
+	mCount = 0;
+	if (slotCount > mSlots.size())
+	{
+		mSlots.assign(slotCount, Slot{ 0, 0, 0, kEmpty });
+		mMask = slotCount - 1;
+	}
+	else
+	{
+		for (size_t i : mUsedSlots)
+			mSlots[i].index = kEmpty;
+	}
+	mUsedSlots.clear();
+}
+bool VertexWeldTable::FindOrInsert(int v, int vt, int vn, uint32_t newIndex, uint32_t& index)
+{
+	if ((mCount + 1) * 2 > mSlots.size())
+		Rehash(mSlots.empty() ? 64 : mSlots.size() * 2);
+
+	++mStats.lookups;
+	size_t probe = 0;
+	bool inserted = false;
+	size_t i = Hash(v, vt, vn) & mMask;
+	while (true)
+	{
+		Slot& slot = mSlots[i];
+		if (slot.index == kEmpty)
+		{
+			slot = Slot{ v, vt, vn, newIndex };
+			mUsedSlots.push_back(i);
+			++mCount;
+			++mStats.inserted;
+			index = newIndex;
+			inserted = true;
+			break;
+		}
+		if (slot.v == v && slot.vt == vt && slot.vn == vn)
+		{
+			index = slot.index;
+			break;
+		}
+		i = (i + 1) & mMask;
+		++probe;
+	}
+	mStats.totalProbes += probe;
+	if (probe > mStats.maxProbe)
+		mStats.maxProbe = probe;
+	return inserted;
+}
+void VertexWeldTable::Report(const std::string& name) const
+{
+	if (mStats.lookups == 0)
+		return;
+	char text[256];
+	sprintf_s(text, "%s: welded %zu corners into %zu vertices (%.2fx), avg probe %.3f, max probe %zu\n",
+		name.c_str(), mStats.lookups, mStats.inserted,
+		double(mStats.lookups) / double(mStats.inserted ? mStats.inserted : 1),
+		double(mStats.totalProbes) / double(mStats.lookups), mStats.maxProbe);
+	OutputDebugStringA(text);
+}
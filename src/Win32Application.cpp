@@ -56,6 +56,11 @@ int Win32Application::Run(DXSample* pSample, HINSTANCE hInstance, int nCmdShow)
     ShowWindow(m_hwnd, nCmdShow);
 
     // Main sample loop.
+    // Benchmark counters
+    __int64 countsPerSecond, startTime, currentTime;
+    QueryPerformanceFrequency((LARGE_INTEGER*)&countsPerSecond);
+    QueryPerformanceCounter((LARGE_INTEGER*)&startTime);
+    UINT64 frameCount = 0;
     MSG msg = {};
     while (msg.message != WM_QUIT)
     {
@@ -67,9 +72,27 @@ int Win32Application::Run(DXSample* pSample, HINSTANCE hInstance, int nCmdShow)
         }
         else
         {
+            // Queue is empty, run a frame
+            pSample->OnUpdate();
+            pSample->OnRender();
+            ++frameCount;
+            pSample->WaitForNextFrame();
+
+            QueryPerformanceCounter((LARGE_INTEGER*)&currentTime);
+            float seconds = static_cast<float>(currentTime - startTime) / countsPerSecond;
+            if (pSample->IsBenchmark() && pSample->GetBenchmarkSeconds() > 0.0f && seconds >= pSample->GetBenchmarkSeconds())
+                DestroyWindow(m_hwnd);
         }
     }
 
+    if (pSample->IsBenchmark() && frameCount > 0)
+    {
+        QueryPerformanceCounter((LARGE_INTEGER*)&currentTime);
+        double seconds = static_cast<double>(currentTime - startTime) / countsPerSecond;
+        std::string report = "Benchmark: " + std::to_string(frameCount) + " frames in " + std::to_string(seconds) + " s, "
+            + std::to_string(frameCount / seconds) + " FPS, " + std::to_string(seconds * 1000.0 / frameCount) + " ms per frame\n";
+        OutputDebugStringA(report.c_str());
+    }
     pSample->OnDestroy();
 
     // Return this part of the WM_QUIT message to Windows.
@@ -109,8 +132,8 @@ LRESULT CALLBACK Win32Application::WindowProc(HWND hWnd, UINT message, WPARAM wP
         pSample->OnKeyUp(static_cast<UINT8>(wParam));
         break;
     case WM_PAINT:
-        pSample->OnUpdate();
-        pSample->OnRender();
+        // Frames are run from the loop in Run(), only mark the window as painted
+        ValidateRect(hWnd, nullptr);
         break;
     case WM_DESTROY:
         //MessageBox()